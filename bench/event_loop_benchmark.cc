@@ -0,0 +1,295 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Microbenchmarks for EventLoop that need neither a running Flutter engine
+// nor a Wayland compositor. Results are written as JSON.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clock_domain.h"
+#include "event_loop.h"
+
+namespace flutter {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t SteadyNowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+double SecondsSince(const Clock::time_point& start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// An EventLoop whose WaitUntil and Wake are implemented in memory, so that
+// the benchmarks measure the loop itself rather than any kernel wait
+// primitive.
+class InMemoryEventLoop : public EventLoop {
+ public:
+  InMemoryEventLoop(const TaskExpiredCallback& on_task_expired,
+                    ClockDomain& clock_domain)
+      : EventLoop(std::this_thread::get_id(), on_task_expired, clock_domain) {}
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool woken_ = false;
+
+  // |EventLoop|
+  WakeReason WaitUntil(const TaskTimePoint& time) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const auto woken = [this]() { return woken_; };
+    if (time == TaskTimePoint::max()) {
+      condition_.wait(lock, woken);
+    } else {
+      condition_.wait_until(lock, time, woken);
+    }
+    if (woken_) {
+      woken_ = false;
+      return WakeReason::kWake;
+    }
+    return TaskTimePoint::clock::now() >= time ? WakeReason::kDeadline
+                                               : WakeReason::kNone;
+  }
+
+  // |EventLoop|
+  void Wake() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (woken_) {
+        return;
+      }
+      woken_ = true;
+    }
+    condition_.notify_one();
+  }
+};
+
+class JsonResults {
+ public:
+  void Begin(const std::string& name) {
+    stream_ << (count_++ == 0 ? "\n" : ",\n") << "    {\"name\": \"" << name
+            << "\"";
+  }
+
+  template <typename T>
+  void Add(const std::string& key, T value) {
+    stream_ << ", \"" << key << "\": " << value;
+  }
+
+  void End() { stream_ << "}"; }
+
+  std::string ToString() const {
+    return "{\n  \"benchmarks\": [" + stream_.str() + "\n  ]\n}\n";
+  }
+
+ private:
+  std::stringstream stream_;
+  size_t count_ = 0;
+};
+
+// Posts |total_tasks| tasks from |producers| threads while the calling thread
+// drains them.
+void BenchmarkPostThroughput(size_t producers,
+                             size_t total_tasks,
+                             JsonResults& results) {
+  ClockDomain clock_domain(&SteadyNowNanos);
+  const size_t tasks_per_producer = total_tasks / producers;
+  const size_t expected = tasks_per_producer * producers;
+
+  std::atomic<size_t> tasks_run(0);
+  InMemoryEventLoop* loop_pointer = nullptr;
+  InMemoryEventLoop loop(
+      [&](const FlutterTask* task) {
+        // Make sure the final WaitForEvents call does not block.
+        if (++tasks_run == expected) {
+          loop_pointer->WakeUp();
+        }
+      },
+      clock_domain);
+  loop_pointer = &loop;
+  std::atomic<bool> go(false);
+  std::vector<double> post_seconds(producers);
+  std::vector<std::thread> threads;
+
+  for (size_t p = 0; p < producers; p++) {
+    threads.emplace_back([&, p]() {
+      while (!go.load()) {
+      }
+      const auto start = Clock::now();
+      for (size_t i = 0; i < tasks_per_producer; i++) {
+        FlutterTask task = {};
+        task.task = i;
+        loop.PostTask(task, clock_domain.EngineNow());
+      }
+      post_seconds[p] = SecondsSince(start);
+    });
+  }
+
+  const auto start = Clock::now();
+  go = true;
+  while (tasks_run.load() < expected) {
+    loop.WaitForEvents();
+  }
+  const double elapsed = SecondsSince(start);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const double slowest_producer =
+      *std::max_element(post_seconds.begin(), post_seconds.end());
+
+  results.Begin("post_throughput");
+  results.Add("producers", producers);
+  results.Add("tasks", expected);
+  results.Add("seconds", elapsed);
+  results.Add("posts_per_second", expected / slowest_producer);
+  results.Add("tasks_per_second", expected / elapsed);
+  results.Add("wakeups", loop.GetWakeupCounters().wakeups);
+  results.End();
+}
+
+// Measures the time from PostTask on another thread to the task running on an
+// idle loop.
+void BenchmarkDispatchLatency(size_t samples, JsonResults& results) {
+  ClockDomain clock_domain(&SteadyNowNanos);
+  std::atomic<uint64_t> posted_at(0);
+  std::atomic<bool> ran(false);
+  std::vector<uint64_t> latencies;
+  latencies.reserve(samples);
+
+  InMemoryEventLoop loop(
+      [&](const FlutterTask* task) {
+        latencies.push_back(SteadyNowNanos() - posted_at.load());
+        ran = true;
+      },
+      clock_domain);
+
+  std::atomic<bool> done(false);
+  std::thread producer([&]() {
+    for (size_t i = 0; i < samples; i++) {
+      // Give the loop time to go idle before every post.
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      ran = false;
+      FlutterTask task = {};
+      task.task = i;
+      posted_at = SteadyNowNanos();
+      loop.PostTask(task, clock_domain.EngineNow());
+      while (!ran.load()) {
+        std::this_thread::yield();
+      }
+    }
+    done = true;
+    loop.WakeUp();
+  });
+
+  while (!done.load()) {
+    loop.WaitForEvents();
+  }
+  producer.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  const auto& lateness = loop.GetStats().lateness_us;
+
+  results.Begin("dispatch_latency");
+  results.Add("samples", latencies.size());
+  results.Add("p50_ns", latencies[latencies.size() / 2]);
+  results.Add("p99_ns", latencies[latencies.size() * 99 / 100]);
+  results.Add("max_ns", latencies.back());
+  results.Add("lateness_p99_us_upper_bound",
+              lateness.GetPercentileUpperBound(99));
+  results.End();
+}
+
+// Measures the cost of Wake() and of an uncontended PostTask on the calling
+// thread.
+void BenchmarkWakeCost(size_t iterations, JsonResults& results) {
+  ClockDomain clock_domain(&SteadyNowNanos);
+  InMemoryEventLoop loop([](const FlutterTask* task) {}, clock_domain);
+
+  auto start = Clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    loop.WakeUp();
+  }
+  const double wake_seconds = SecondsSince(start);
+
+  const uint64_t target = clock_domain.EngineNow();
+  start = Clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    FlutterTask task = {};
+    task.task = i;
+    loop.PostTask(task, target);
+  }
+  const double post_seconds = SecondsSince(start);
+
+  // Drain what was posted so the queue is torn down empty.
+  loop.WaitForEvents(std::chrono::microseconds(0));
+
+  results.Begin("wake_cost");
+  results.Add("iterations", iterations);
+  results.Add("wake_ns", wake_seconds * 1e9 / iterations);
+  results.Add("post_ns", post_seconds * 1e9 / iterations);
+  results.End();
+}
+
+bool Main(const std::vector<std::string>& args) {
+  std::string output_path;
+  size_t tasks = 1000000;
+
+  for (const auto& arg : args) {
+    if (arg.compare(0, 9, "--output=") == 0) {
+      output_path = arg.substr(9);
+    } else if (arg.compare(0, 8, "--tasks=") == 0) {
+      tasks = std::max<size_t>(strtoull(arg.c_str() + 8, nullptr, 10), 8);
+    } else {
+      std::cerr << "Usage: flutter_wayland_bench [--output=<file.json>] "
+                   "[--tasks=<count>]"
+                << std::endl;
+      return false;
+    }
+  }
+
+  JsonResults results;
+  for (size_t producers = 1; producers <= 8; producers *= 2) {
+    BenchmarkPostThroughput(producers, tasks, results);
+  }
+  BenchmarkDispatchLatency(2000, results);
+  BenchmarkWakeCost(tasks, results);
+
+  if (output_path.empty()) {
+    std::cout << results.ToString();
+    return true;
+  }
+
+  std::ofstream output(output_path);
+  output << results.ToString();
+  if (!output) {
+    std::cerr << "Could not write " << output_path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+}  // namespace flutter
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  return flutter::Main(args) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,58 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "adaptive_resolution.h"
+
+namespace flutter {
+
+constexpr size_t AdaptiveResolution::kWindow;
+
+// The steps never go below half the native resolution, a quarter of the
+// pixels. Below that, text gets unreadable.
+static constexpr double kScales[] = {1.0, 0.85, 0.7, 0.6, 0.5};
+static constexpr size_t kStepCount = sizeof(kScales) / sizeof(kScales[0]);
+
+// Lower the resolution when frames take more than this much of the budget.
+static constexpr double kShrinkThreshold = 0.9;
+
+// Raise it when the next larger step is predicted to take less than this.
+static constexpr double kGrowThreshold = 0.7;
+
+AdaptiveResolution::AdaptiveResolution() = default;
+
+bool AdaptiveResolution::AddFrame(std::chrono::nanoseconds frame_time,
+                                  std::chrono::nanoseconds budget) {
+  frame_time_sum_ += frame_time;
+  budget_sum_ += budget;
+  if (++frame_count_ < kWindow) {
+    return false;
+  }
+
+  const double load = static_cast<double>(frame_time_sum_.count()) /
+                      static_cast<double>(budget_sum_.count());
+  frame_count_ = 0;
+  frame_time_sum_ = std::chrono::nanoseconds(0);
+  budget_sum_ = std::chrono::nanoseconds(0);
+
+  if (load > kShrinkThreshold && step_ + 1 < kStepCount) {
+    step_++;
+    return true;
+  }
+
+  if (step_ > 0) {
+    const double ratio = kScales[step_ - 1] / kScales[step_];
+    if (load * ratio * ratio < kGrowThreshold) {
+      step_--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+double AdaptiveResolution::GetScale() const {
+  return kScales[step_];
+}
+
+}  // namespace flutter
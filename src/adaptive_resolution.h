@@ -0,0 +1,47 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+#include "macros.h"
+
+namespace flutter {
+
+// Picks the fraction of the native resolution to render at from recent frame
+// times. Rasterization cost grows with the pixel count, so the resolution is
+// lowered a step at a time while frames miss their budget, and raised again
+// once the frame times predict that the larger step would comfortably fit.
+//
+// Every decision is based on a full window of frames rendered at the current
+// step, which together with the gap between the two thresholds keeps it from
+// oscillating.
+class AdaptiveResolution {
+ public:
+  AdaptiveResolution();
+
+  // Records the time it took to render a frame at the current scale, against
+  // the time available for it. Returns true if the scale changed, after which
+  // only frames rendered at the new scale may be added.
+  bool AddFrame(std::chrono::nanoseconds frame_time,
+                std::chrono::nanoseconds budget);
+
+  // Returns the factor to apply to both dimensions of the native resolution.
+  double GetScale() const;
+
+ private:
+  // Frames averaged per decision.
+  static constexpr size_t kWindow = 30;
+
+  size_t step_ = 0;
+  size_t frame_count_ = 0;
+  std::chrono::nanoseconds frame_time_sum_{0};
+  std::chrono::nanoseconds budget_sum_{0};
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(AdaptiveResolution);
+};
+
+}  // namespace flutter
@@ -0,0 +1,91 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "clock_domain.h"
+
+#include <cstdlib>
+#include <limits>
+
+namespace flutter {
+
+// Number of bracketed samples taken per measurement. The one with the
+// tightest bracket wins.
+static constexpr int kOffsetSamples = 5;
+
+// Offset changes larger than this are treated as a step rather than drift.
+static constexpr int64_t kStepThresholdNanos = 1000000;
+
+static int64_t SteadyNanos(const ClockDomain::TimePoint& time_point) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             time_point.time_since_epoch())
+      .count();
+}
+
+constexpr std::chrono::seconds ClockDomain::kResyncInterval;
+
+ClockDomain::ClockDomain(EngineClock engine_clock)
+    : engine_clock_(std::move(engine_clock)) {
+  offset_nanos_ = MeasureOffset();
+  next_resync_nanos_ =
+      SteadyNanos(TimePoint::clock::now() + kResyncInterval);
+}
+
+ClockDomain::TimePoint ClockDomain::ToTimePoint(uint64_t engine_nanos) const {
+  const int64_t steady_nanos = static_cast<int64_t>(engine_nanos) +
+                               offset_nanos_.load(std::memory_order_relaxed);
+  return TimePoint(std::chrono::duration_cast<TimePoint::duration>(
+      std::chrono::nanoseconds(steady_nanos)));
+}
+
+uint64_t ClockDomain::ToEngineTime(const TimePoint& time_point) const {
+  return static_cast<uint64_t>(SteadyNanos(time_point) -
+                               offset_nanos_.load(std::memory_order_relaxed));
+}
+
+uint64_t ClockDomain::EngineNow() const {
+  return ToEngineTime(TimePoint::clock::now());
+}
+
+void ClockDomain::MaybeResync(const TimePoint& now) {
+  const int64_t now_nanos = SteadyNanos(now);
+  int64_t due = next_resync_nanos_.load(std::memory_order_relaxed);
+  if (now_nanos < due) {
+    return;
+  }
+  const int64_t next = SteadyNanos(now + kResyncInterval);
+  if (!next_resync_nanos_.compare_exchange_strong(due, next)) {
+    // Another thread is already measuring.
+    return;
+  }
+
+  const int64_t measured = MeasureOffset();
+  const int64_t current = offset_nanos_.load(std::memory_order_relaxed);
+  const int64_t error = measured - current;
+  if (std::llabs(error) > kStepThresholdNanos) {
+    FLWAY_LOG << "Engine clock stepped by " << error << "ns." << std::endl;
+    offset_nanos_.store(measured, std::memory_order_relaxed);
+  } else {
+    // Slew halfway so that sampling jitter does not show up as task jitter.
+    offset_nanos_.store(current + error / 2, std::memory_order_relaxed);
+  }
+}
+
+int64_t ClockDomain::MeasureOffset() const {
+  int64_t best_offset = 0;
+  int64_t best_bracket = std::numeric_limits<int64_t>::max();
+
+  for (int i = 0; i < kOffsetSamples; i++) {
+    const int64_t before = SteadyNanos(TimePoint::clock::now());
+    const int64_t engine = static_cast<int64_t>(engine_clock_());
+    const int64_t after = SteadyNanos(TimePoint::clock::now());
+    if (after - before < best_bracket) {
+      best_bracket = after - before;
+      best_offset = before + (after - before) / 2 - engine;
+    }
+  }
+
+  return best_offset;
+}
+
+}  // namespace flutter
@@ -0,0 +1,62 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <flutter_embedder.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "macros.h"
+
+namespace flutter {
+
+// Maps the engine's clock (FlutterEngineGetCurrentTime) onto
+// std::chrono::steady_clock, which the embedder schedules against.
+//
+// The offset between the two clocks is measured once up front and then
+// re-measured at most once per |kResyncInterval|. Small differences are
+// slewed in to correct drift, and large ones are stepped. Conversions only
+// read an atomic offset, so they are cheap and safe from any thread. They
+// never sample the engine clock.
+class ClockDomain {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  // Returns the engine's notion of now, in nanoseconds.
+  using EngineClock = std::function<uint64_t()>;
+
+  explicit ClockDomain(EngineClock engine_clock = &FlutterEngineGetCurrentTime);
+
+  // Returns the steady clock time point of an engine timestamp.
+  TimePoint ToTimePoint(uint64_t engine_nanos) const;
+
+  // Returns the engine timestamp of a steady clock time point.
+  uint64_t ToEngineTime(const TimePoint& time_point) const;
+
+  // Returns the current time in the engine's clock domain.
+  uint64_t EngineNow() const;
+
+  // Re-measures the offset if |kResyncInterval| has elapsed since the last
+  // measurement. Safe to call from any thread; at most one caller measures.
+  void MaybeResync(const TimePoint& now);
+
+ private:
+  static constexpr std::chrono::seconds kResyncInterval{1};
+
+  EngineClock engine_clock_;
+  // steady_clock nanoseconds minus engine nanoseconds.
+  std::atomic<int64_t> offset_nanos_;
+  // steady_clock nanoseconds at which the next resync is due.
+  std::atomic<int64_t> next_resync_nanos_;
+
+  int64_t MeasureOffset() const;
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(ClockDomain);
+};
+
+}  // namespace flutter
@@ -0,0 +1,192 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "embedder_options.h"
+
+#include <cstdlib>
+
+#include "macros.h"
+
+namespace flutter {
+
+static const char kOptionPrefix[] = "--wayland-";
+
+static bool ParseInt(const std::string& value, int min, int* result) {
+  char* end = nullptr;
+  const long parsed = strtol(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || parsed < min) {
+    return false;
+  }
+  *result = static_cast<int>(parsed);
+  return true;
+}
+
+static bool ParseOption(const std::string& name,
+                        const std::string& value,
+                        EmbedderOptions* options) {
+  if (name == "stats-interval") {
+    return ParseInt(value, 0, &options->stats_interval_seconds);
+  }
+
+  if (name == "task-budget") {
+    return ParseInt(value, 1, &options->task_budget_us);
+  }
+
+  if (name == "min-tasks-per-slice") {
+    return ParseInt(value, 1, &options->min_tasks_per_slice);
+  }
+
+  if (name == "swap-interval") {
+    return ParseInt(value, 0, &options->swap_interval);
+  }
+
+  if (name == "headless-frames") {
+    return ParseInt(value, 0, &options->headless_frames);
+  }
+
+  if (name == "adaptive-resolution") {
+    options->adaptive_resolution = true;
+    return value.empty();
+  }
+
+  if (name == "opaque") {
+    options->opaque = true;
+    return value.empty();
+  }
+
+  if (name == "subsurface-layers") {
+    options->subsurface_layers = true;
+    return value.empty();
+  }
+
+  if (name == "headless") {
+    options->headless = true;
+    return value.empty();
+  }
+
+  if (name == "shader-cache") {
+    options->shader_cache_path = value;
+    return !value.empty();
+  }
+
+  if (name == "warmup") {
+    options->warmup = true;
+    options->warmup_script = value;
+    return true;
+  }
+
+  if (name == "renderer") {
+    if (value == "opengl" || value == "software") {
+      options->software_rendering = value == "software";
+      return true;
+    }
+    return false;
+  }
+
+  return false;
+}
+
+bool ParseEmbedderOptions(std::vector<std::string>* args,
+                          EmbedderOptions* options) {
+  const std::string prefix = kOptionPrefix;
+  std::vector<std::string> engine_args;
+
+  for (const auto& arg : *args) {
+    if (arg.compare(0, prefix.size(), prefix) != 0) {
+      engine_args.push_back(arg);
+      continue;
+    }
+
+    const auto equals = arg.find('=');
+    const auto name = arg.substr(prefix.size(), equals - prefix.size());
+    const auto value =
+        equals == std::string::npos ? std::string{} : arg.substr(equals + 1);
+
+    if (!ParseOption(name, value, options)) {
+      FLWAY_ERROR << "Invalid embedder option: " << arg << std::endl;
+      return false;
+    }
+  }
+
+  *args = std::move(engine_args);
+  return true;
+}
+
+const char* GetEmbedderOptionsUsage() {
+  return R"~(
+  embedder_flags: Flags starting with "--wayland-" configure this embedder and
+                  are not passed to the Flutter engine.
+
+                  --wayland-stats-interval=<seconds>
+                      Dump event loop statistics every <seconds>. They are
+                      also dumped whenever the process receives SIGUSR1.
+                      With wp_presentation, so are the latency from vsync to
+                      the frame reaching the screen and the missed vblanks.
+
+                  --wayland-task-budget=<microseconds>
+                      How long the platform thread may run expired engine
+                      tasks back to back before it handles pending Wayland
+                      input. Defaults to 4000.
+
+                  --wayland-min-tasks-per-slice=<count>
+                      Tasks run back to back before the budget is even
+                      checked. Defaults to 4.
+
+                  --wayland-renderer=<opengl|software>
+                      Render with EGL (the default) or on the CPU into shared
+                      memory buffers, for machines without a usable GPU.
+
+                  --wayland-swap-interval=<frames>
+                      EGL swap interval. Defaults to 0, which never blocks the
+                      render thread in eglSwapBuffers and paces frames from
+                      the compositor's frame callbacks instead.
+
+                  --wayland-adaptive-resolution
+                      Lower the render resolution in steps while frames take
+                      longer than the refresh period, and restore it once
+                      there is headroom again. Needs wp_viewporter.
+
+                  --wayland-opaque
+                      Render without an alpha channel and mark the whole
+                      surface opaque. The chosen EGL config is logged.
+
+                  --wayland-subsurface-layers
+                      Present each layer the engine composites in a
+                      subsurface of its own and leave blending them to the
+                      compositor. Layers that did not change are not drawn
+                      again. Needs wl_subcompositor and the OpenGL renderer.
+
+                  --wayland-headless
+                      Render offscreen through EGL, without a compositor, at
+                      a synthetic 60 Hz vsync. Build, raster and present
+                      times of every frame are logged, and the frame rate
+                      once a second. Mesa's llvmpipe is enough. Cannot be
+                      combined with --wayland-renderer=software,
+                      --wayland-subsurface-layers, --wayland-opaque or
+                      --wayland-adaptive-resolution. Neither can
+                      --wayland-warmup, which renders headless too.
+
+                  --wayland-headless-frames=<count>
+                      Exit after <count> frames in headless mode, with a
+                      summary of the timings.
+
+                  --wayland-shader-cache=<directory>
+                      Keep the engine's compiled shaders in <directory>, so
+                      later launches load them instead of compiling them
+                      again. The directory is created if needed.
+
+                  --wayland-warmup[=<script>]
+                      Fill the shader cache, which must be set, and exit.
+                      Renders headless and has the engine cache shaders in
+                      a portable form, which is compiled ahead of the first
+                      frame on later launches. The optional <script> lists
+                      touch events to replay, one per line, as
+                      "<frame> <down|move|up> <x> <y>", with frames
+                      counted at 60 Hz whether or not anything is drawn.
+                      The run ends 120 frames after the last one, or after
+                      --wayland-headless-frames if given.
+)~";
+}
+
+}  // namespace flutter
@@ -0,0 +1,68 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace flutter {
+
+// Options for the embedder itself, as opposed to the flags it forwards to the
+// Flutter engine. They are all spelled "--wayland-<name>[=<value>]".
+struct EmbedderOptions {
+  // Seconds between event loop statistics dumps. Zero only dumps on SIGUSR1.
+  int stats_interval_seconds = 0;
+
+  // How long, in microseconds, the platform thread may run engine tasks back
+  // to back before it services Wayland events, and how many tasks it runs
+  // before it even checks. Zero keeps the event loop's default.
+  int task_budget_us = 0;
+  int min_tasks_per_slice = 0;
+
+  // Rasterize on the CPU and present through wl_shm instead of EGL, for
+  // machines without a usable GPU.
+  bool software_rendering = false;
+
+  // EGL swap interval. At zero, swaps never wait for the compositor and the
+  // embedder paces frames from wl_surface.frame callbacks itself.
+  int swap_interval = 0;
+
+  // Render below native resolution while frames miss their deadline, and let
+  // the compositor scale the result up.
+  bool adaptive_resolution = false;
+
+  // Render without alpha and declare the whole surface opaque, which lets the
+  // compositor skip blending it.
+  bool opaque = false;
+
+  // Present each engine layer in a wl_subsurface of its own and let the
+  // compositor stack them, instead of flattening them into one surface.
+  bool subsurface_layers = false;
+
+  // Render offscreen, without a Wayland compositor, and log frame timings.
+  bool headless = false;
+
+  // Frames to render before exiting in headless mode. Zero for no limit.
+  int headless_frames = 0;
+
+  // Directory the engine keeps compiled shaders in across launches. Empty for
+  // no persistent cache.
+  std::string shader_cache_path;
+
+  // Render headless, replaying |warmup_script| if set, to fill the shader
+  // cache, then exit.
+  bool warmup = false;
+  std::string warmup_script;
+};
+
+// Removes the embedder's own flags from |args| and records them in |options|.
+// Returns false, after logging why, if a flag is unknown or malformed.
+bool ParseEmbedderOptions(std::vector<std::string>* args,
+                          EmbedderOptions* options);
+
+// Returns the usage text describing the embedder's own flags.
+const char* GetEmbedderOptionsUsage();
+
+}  // namespace flutter
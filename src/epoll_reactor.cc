@@ -0,0 +1,165 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "epoll_reactor.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace flutter {
+
+static constexpr int kMaxEventsPerWait = 16;
+
+EpollReactor::EpollReactor() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1) {
+    FLWAY_ERROR << "epoll create failed: " << errno << std::endl;
+    return;
+  }
+
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ == -1) {
+    FLWAY_ERROR << "timerfd create failed: " << errno << std::endl;
+    return;
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = timer_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event) == -1) {
+    FLWAY_ERROR << "Could not watch the timerfd: " << errno << std::endl;
+    close(timer_fd_);
+    timer_fd_ = -1;
+  }
+}
+
+EpollReactor::~EpollReactor() {
+  if (timer_fd_ != -1) {
+    close(timer_fd_);
+  }
+
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
+  }
+}
+
+bool EpollReactor::IsValid() const {
+  return epoll_fd_ != -1 && timer_fd_ != -1;
+}
+
+bool EpollReactor::AddFd(int fd, uint32_t events, FdCallback callback) {
+  if (fd < 0 || !callback) {
+    FLWAY_ERROR << "Invalid descriptor or callback." << std::endl;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(callbacks_mutex_);
+  epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == -1) {
+    FLWAY_ERROR << "Could not watch fd " << fd << ": " << errno << std::endl;
+    return false;
+  }
+  callbacks_[fd] = std::move(callback);
+  return true;
+}
+
+bool EpollReactor::RemoveFd(int fd) {
+  std::lock_guard<std::mutex> lock(callbacks_mutex_);
+  if (callbacks_.erase(fd) == 0) {
+    return false;
+  }
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+    FLWAY_ERROR << "Could not unwatch fd " << fd << ": " << errno
+                << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool EpollReactor::ArmTimer(const TimePoint& deadline) {
+  if (deadline == armed_deadline_) {
+    return true;
+  }
+
+  itimerspec spec = {};
+  if (deadline != TimePoint::max()) {
+    // steady_clock is CLOCK_MONOTONIC on Linux, so its epoch is the timerfd's.
+    const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           deadline.time_since_epoch())
+                           .count();
+    spec.it_value.tv_sec = nanos / 1000000000;
+    spec.it_value.tv_nsec = nanos % 1000000000;
+    // An all-zero it_value disarms the timer instead of firing it.
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+      spec.it_value.tv_nsec = 1;
+    }
+  }
+
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+    FLWAY_ERROR << "Could not arm the timerfd: " << errno << std::endl;
+    armed_deadline_ = TimePoint::max();
+    return false;
+  }
+  armed_deadline_ = deadline;
+  return true;
+}
+
+EpollReactor::WaitResult EpollReactor::WaitUntil(const TimePoint& deadline) {
+  WaitResult result;
+
+  if (!IsValid()) {
+    return result;
+  }
+
+  int timeout_ms = -1;
+  if (deadline != TimePoint::max() && deadline <= TimePoint::clock::now()) {
+    timeout_ms = 0;
+  } else if (!ArmTimer(deadline)) {
+    // Fall back to a millisecond timeout rather than oversleeping.
+    timeout_ms = 1;
+  }
+
+  epoll_event events[kMaxEventsPerWait];
+  const int count = epoll_wait(epoll_fd_, events, kMaxEventsPerWait, timeout_ms);
+  if (count < 0 && errno != EINTR) {
+    FLWAY_ERROR << "epoll_wait returned an error: " << errno << std::endl;
+  }
+
+  for (int i = 0; i < count; i++) {
+    const int fd = events[i].data.fd;
+
+    if (fd == timer_fd_) {
+      uint64_t expirations = 0;
+      if (read(timer_fd_, &expirations, sizeof(expirations)) == -1 &&
+          errno != EAGAIN) {
+        FLWAY_ERROR << "Could not read the timerfd: " << errno << std::endl;
+      }
+      armed_deadline_ = TimePoint::max();
+      continue;
+    }
+
+    FdCallback callback;
+    {
+      std::lock_guard<std::mutex> lock(callbacks_mutex_);
+      auto found = callbacks_.find(fd);
+      if (found == callbacks_.end()) {
+        // Removed by an earlier callback in this batch.
+        continue;
+      }
+      callback = found->second;
+    }
+    callback(events[i].events);
+    result.dispatched++;
+  }
+
+  result.deadline_reached = deadline != TimePoint::max() &&
+                            deadline <= TimePoint::clock::now();
+  return result;
+}
+
+}  // namespace flutter
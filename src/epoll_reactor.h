@@ -0,0 +1,70 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include "macros.h"
+
+namespace flutter {
+
+// Multiplexes file descriptors and a single deadline on one thread.
+//
+// Deadlines are enforced by a CLOCK_MONOTONIC timerfd armed to the absolute
+// fire time, so waits are exact to the nanosecond rather than rounded to the
+// millisecond granularity of poll() and epoll_wait() timeouts. Any subsystem
+// may register additional descriptors; their callbacks run on the thread that
+// calls WaitUntil().
+class EpollReactor {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  // Invoked with the ready epoll event mask (EPOLLIN, EPOLLHUP, ...).
+  using FdCallback = std::function<void(uint32_t events)>;
+
+  struct WaitResult {
+    // Number of registered descriptors whose callbacks were invoked.
+    size_t dispatched = 0;
+    // True if the wait ended because |deadline| was reached.
+    bool deadline_reached = false;
+  };
+
+  EpollReactor();
+
+  ~EpollReactor();
+
+  bool IsValid() const;
+
+  // Starts watching |fd| for |events|. Safe to call from any thread.
+  bool AddFd(int fd, uint32_t events, FdCallback callback);
+
+  // Stops watching |fd|. Safe to call from any thread. The callback will not
+  // be invoked once this returns, unless it is called from that callback.
+  bool RemoveFd(int fd);
+
+  // Blocks until |deadline| passes or at least one registered descriptor is
+  // ready, then invokes the callbacks of the ready descriptors. A deadline of
+  // TimePoint::max() waits indefinitely; a deadline in the past only polls.
+  WaitResult WaitUntil(const TimePoint& deadline);
+
+ private:
+  int epoll_fd_ = -1;
+  int timer_fd_ = -1;
+  // The deadline the timerfd is currently armed for, or TimePoint::max().
+  TimePoint armed_deadline_ = TimePoint::max();
+  std::mutex callbacks_mutex_;
+  std::unordered_map<int, FdCallback> callbacks_;
+
+  bool ArmTimer(const TimePoint& deadline);
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(EpollReactor);
+};
+
+}  // namespace flutter
@@ -11,9 +11,11 @@
 namespace flutter {
 
 EventLoop::EventLoop(std::thread::id main_thread_id,
-                     const TaskExpiredCallback& on_task_expired)
+                     const TaskExpiredCallback& on_task_expired,
+                     ClockDomain& clock_domain)
 	: main_thread_id_(main_thread_id),
-    on_task_expired_(std::move(on_task_expired)) {}
+    on_task_expired_(std::move(on_task_expired)),
+    clock_domain_(clock_domain) {}
 
 EventLoop::~EventLoop() = default;
 
@@ -21,13 +23,20 @@ bool EventLoop::RunsTasksOnCurrentThread() const {
   return std::this_thread::get_id() == main_thread_id_;
 }
 
+void EventLoop::WakeUp() {
+  Wake();
+}
+
 void EventLoop::WaitForEvents(std::chrono::microseconds max_wait) {
   const auto now = TaskTimePoint::clock::now();
-  std::vector<FlutterTask> expired_tasks;
+  std::vector<Task> expired_tasks;
+
+  clock_domain_.MaybeResync(now);
 
   // Process expired tasks.
   {
-    std::lock_guard<std::mutex> lock(task_queue_mutex_);
+    ScheduleIncomingTasks();
+    stats_.queue_depth.Add(task_queue_.size());
     while (!task_queue_.empty()) {
       const auto& top = task_queue_.top();
       // If this task (and all tasks after this) has not yet expired, there is
@@ -37,22 +46,43 @@ void EventLoop::WaitForEvents(std::chrono::microseconds max_wait) {
       }
 
       // Make a record of the expired task. Do NOT service the task here
-      // because we are still holding onto the task queue mutex. We don't want
-      // other threads to block on posting tasks onto this thread till we are
-      // done processing expired tasks.
-      expired_tasks.push_back(task_queue_.top().task);
+      // because tasks run now may post new tasks that must not jump ahead of
+      // tasks that already expired.
+      expired_tasks.push_back(task_queue_.top());
 
       // Remove the tasks from the delayed tasks queue.
       task_queue_.pop();
     }
   }
 
-  // Fire expired tasks.
+  // Fire expired tasks in slices of |policy_.task_budget|. Between slices,
+  // events that are already pending are serviced without blocking, so a
+  // backlog of engine tasks cannot hold up touch handling. Every task that
+  // expired above still runs in this call.
   {
-    // Flushing tasks here without holing onto the task queue mutex.
-    for (const auto& task : expired_tasks) {
+    auto slice_start = TaskTimePoint::clock::now();
+    auto task_start = slice_start;
+    size_t slice_tasks = 0;
+    for (size_t i = 0; i < expired_tasks.size(); i++) {
       //FLWAY_ERROR << "POLLONCE:Execute an Expired task"<<std::endl;
-      on_task_expired_(&task);
+      on_task_expired_(&expired_tasks[i].task);
+
+      const auto task_end = TaskTimePoint::clock::now();
+      RecordTask(expired_tasks[i], task_start, task_end);
+      task_start = task_end;
+
+      const bool more_tasks = i + 1 < expired_tasks.size();
+      if (!more_tasks || ++slice_tasks < policy_.min_tasks_per_slice) {
+        continue;
+      }
+      if (task_end - slice_start < policy_.task_budget) {
+        continue;
+      }
+      IncrementSingleWriter(stats_.budget_yields);
+      WaitUntil(TaskTimePoint::min());
+      slice_start = TaskTimePoint::clock::now();
+      task_start = slice_start;
+      slice_tasks = 0;
     }
   }
 
@@ -61,7 +91,9 @@ void EventLoop::WaitForEvents(std::chrono::microseconds max_wait) {
   {
     TaskTimePoint next_wake;
     {
-      std::lock_guard<std::mutex> lock(task_queue_mutex_);
+      // Pick up anything posted while the expired tasks were running so the
+      // deadline below accounts for it.
+      ScheduleIncomingTasks();
       TaskTimePoint max_wake_timepoint =
           max_wait == std::chrono::microseconds::max() ? TaskTimePoint::max()
                                                       : now + max_wait;
@@ -70,16 +102,71 @@ void EventLoop::WaitForEvents(std::chrono::microseconds max_wait) {
                                           : task_queue_.top().fire_time;
       next_wake = std::min(max_wake_timepoint, next_event_timepoint);
     }
-    WaitUntil(next_wake);
+    RecordWakeup(WaitUntil(next_wake));
+  }
+}
+
+void EventLoop::SetSchedulingPolicy(const SchedulingPolicy& policy) {
+  policy_ = policy;
+}
+
+EventLoop::WakeupCounters EventLoop::GetWakeupCounters() const {
+  WakeupCounters counters;
+  counters.wakeups = stats_.wakeups.load(std::memory_order_relaxed);
+  counters.spurious_wakeups =
+      stats_.spurious_wakeups.load(std::memory_order_relaxed);
+  return counters;
+}
+
+const EventLoopStats& EventLoop::GetStats() const {
+  return stats_;
+}
+
+void EventLoop::RecordTask(const Task& task,
+                           const TaskTimePoint& start,
+                           const TaskTimePoint& end) {
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  IncrementSingleWriter(stats_.tasks_run);
+  stats_.lateness_us.Add(
+      start > task.fire_time
+          ? duration_cast<microseconds>(start - task.fire_time).count()
+          : 0);
+  stats_.execution_us.Add(duration_cast<microseconds>(end - start).count());
+}
+
+void EventLoop::RecordWakeup(WakeReason reason) {
+  static_assert(static_cast<size_t>(WakeReason::kNone) + 1 ==
+                    EventLoopStats::kWakeReasonCount,
+                "Wake reason names are out of sync.");
+  IncrementSingleWriter(stats_.wakeups);
+  IncrementSingleWriter(stats_.wake_reasons[static_cast<size_t>(reason)]);
+
+  bool spurious = reason == WakeReason::kNone;
+  if (reason == WakeReason::kDeadline) {
+    // A deadline wakeup only did something useful if a task is now due. This
+    // also catches callers polling with a short |max_wait|.
+    ScheduleIncomingTasks();
+    spurious = task_queue_.empty() ||
+               task_queue_.top().fire_time > TaskTimePoint::clock::now();
+  }
+
+  if (spurious) {
+    IncrementSingleWriter(stats_.spurious_wakeups);
+  }
+}
+
+void EventLoop::ScheduleIncomingTasks() {
+  Task task;
+  while (incoming_tasks_.Pop(&task)) {
+    task_queue_.push(task);
   }
 }
 
 EventLoop::TaskTimePoint EventLoop::TimePointFromFlutterTime(
-    uint64_t flutter_target_time_nanos) {
-  const auto now = TaskTimePoint::clock::now();
-  const int64_t flutter_duration =
-      flutter_target_time_nanos - FlutterEngineGetCurrentTime();
-  return now + std::chrono::microseconds(flutter_duration);
+    uint64_t flutter_target_time_nanos) const {
+  return clock_domain_.ToTimePoint(flutter_target_time_nanos);
 }
 
 void EventLoop::PostTask(FlutterTask flutter_task,
@@ -91,15 +178,10 @@ void EventLoop::PostTask(FlutterTask flutter_task,
   task.fire_time = TimePointFromFlutterTime(flutter_target_time_nanos);
   task.task = flutter_task;
 
-  {
-    std::lock_guard<std::mutex> lock(task_queue_mutex_);
-    task_queue_.push(task);
-
-    // Make sure the queue mutex is unlocked before waking up the loop. In case
-    // the wake causes this thread to be descheduled for the primary thread to
-    // process tasks, the acquisition of the lock on that thread while holding
-    // the lock here momentarily till the end of the scope is a pessimization.
-  }
+  // The wake must come after the push. The loop only promises to look at the
+  // intake queue after it has been woken.
+  incoming_tasks_.Push(task);
+  stats_.tasks_posted.fetch_add(1, std::memory_order_relaxed);
   Wake();
 }
 
@@ -5,14 +5,18 @@
 #ifndef FLUTTER_SHELL_PLATFORM_GLFW_EVENT_LOOP_H_
 #define FLUTTER_SHELL_PLATFORM_GLFW_EVENT_LOOP_H_
 
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <functional>
-#include <mutex>
 #include <queue>
 #include <thread>
 #include <flutter_embedder.h>
 
+#include "clock_domain.h"
+#include "event_loop_stats.h"
+#include "mpsc_queue.h"
+
 namespace flutter {
 
 // An abstract event loop.
@@ -20,10 +24,30 @@ class EventLoop {
  public:
   using TaskExpiredCallback = std::function<void(const FlutterTask*)>;
 
+  struct SchedulingPolicy {
+    // How long expired tasks may run back to back before the loop services
+    // pending events (such as Wayland input) and then resumes draining.
+    std::chrono::microseconds task_budget = std::chrono::microseconds(4000);
+    // Tasks run per slice before the budget is even checked. This keeps a
+    // long backlog draining at full throughput instead of polling for events
+    // after every task.
+    size_t min_tasks_per_slice = 4;
+  };
+
+  struct WakeupCounters {
+    // Number of times the loop returned from waiting.
+    uint64_t wakeups = 0;
+    // Wakeups that found nothing to do: no expired task, no Wake() and no
+    // event on a watched descriptor. An idle loop should never produce these.
+    uint64_t spurious_wakeups = 0;
+  };
+
   // Creates an event loop running on the given thread, calling
-  // |on_task_expired| to run tasks.
+  // |on_task_expired| to run tasks. Engine task times are mapped onto the
+  // loop's clock through |clock_domain|, which must outlive the loop.
   EventLoop(std::thread::id main_thread_id,
-            const TaskExpiredCallback& on_task_expired);
+            const TaskExpiredCallback& on_task_expired,
+            ClockDomain& clock_domain);
 
   virtual ~EventLoop();
 
@@ -36,28 +60,56 @@ class EventLoop {
 
   // Waits for the next event, processes it, and returns.
   //
-  // Expired engine events, if any, are processed as well. The optional
-  // timeout should only be used when events not managed by this loop need to be
-  // processed in a polling manner.
+  // Expired engine events, if any, are processed as well. Without a timeout
+  // the loop blocks until the next task deadline, an event, or a Wake() call,
+  // and never wakes up otherwise. The optional timeout should only be used
+  // when events not managed by this loop need to be processed in a polling
+  // manner.
   void WaitForEvents(
       std::chrono::microseconds max_wait = std::chrono::microseconds::max());
 
   // Posts a Flutter engine task to the event loop for delayed execution.
+  //
+  // May be called from any thread. This never takes a lock: the task goes
+  // into a lock-free intake queue that the loop's own thread merges into its
+  // private timer heap.
   void PostTask(FlutterTask flutter_task, uint64_t flutter_target_time_nanos);
 
+  // Makes the loop thread return from WaitForEvents, so that its caller can
+  // check on state changed by other threads. May be called from any thread.
+  void WakeUp();
+
+  // Replaces the scheduling policy. Must be called on the loop thread.
+  void SetSchedulingPolicy(const SchedulingPolicy& policy);
+
+  // Returns a snapshot of the wakeup counters. Safe to call from any thread.
+  WakeupCounters GetWakeupCounters() const;
+
+  // Returns the loop's scheduling statistics. They are updated on the loop
+  // thread but may be read, and dumped, from any thread.
+  const EventLoopStats& GetStats() const;
+
  protected:
   using TaskTimePoint = std::chrono::steady_clock::time_point;
 
   // Returns the timepoint corresponding to a Flutter task time.
-  static TaskTimePoint TimePointFromFlutterTime(
-      uint64_t flutter_target_time_nanos);
-
-  // Returns the mutex used to control the task queue. Subclasses may safely
-  // lock this mutex in the abstract methods below.
-  std::mutex& GetTaskQueueMutex() { return task_queue_mutex_; }
+  TaskTimePoint TimePointFromFlutterTime(
+      uint64_t flutter_target_time_nanos) const;
+
+  // Why a WaitUntil() call returned, most significant reason first.
+  enum class WakeReason {
+    // A descriptor or event source not owned by the loop became ready.
+    kEvent,
+    // Wake() was called.
+    kWake,
+    // The requested time was reached.
+    kDeadline,
+    // None of the above, e.g. the wait was interrupted by a signal.
+    kNone,
+  };
 
   // Waits until the given time, or a Wake() call.
-  virtual void WaitUntil(const TaskTimePoint& time) = 0;
+  virtual WakeReason WaitUntil(const TaskTimePoint& time) = 0;
 
   // Wakes the main thread from a WaitUntil call.
   virtual void Wake() = 0;
@@ -78,8 +130,27 @@ class EventLoop {
   };
   std::thread::id main_thread_id_;
   TaskExpiredCallback on_task_expired_;
-  std::mutex task_queue_mutex_;
+  ClockDomain& clock_domain_;
+  // Tasks posted from any thread that have not been scheduled yet.
+  MpscQueue<Task> incoming_tasks_;
+  // Scheduled tasks ordered by fire time. Only touched on the loop thread.
   std::priority_queue<Task, std::deque<Task>, Task::Comparer> task_queue_;
+
+ private:
+  SchedulingPolicy policy_;
+  EventLoopStats stats_;
+
+  // Moves everything in |incoming_tasks_| into |task_queue_|. Must be called
+  // on the loop thread.
+  void ScheduleIncomingTasks();
+
+  // Records lateness and run time of a task that ran from |start| to |end|.
+  void RecordTask(const Task& task,
+                  const TaskTimePoint& start,
+                  const TaskTimePoint& end);
+
+  // Updates the wakeup counters after WaitUntil() returned for |reason|.
+  void RecordWakeup(WakeReason reason);
 };
 
 }  // namespace flutter
@@ -0,0 +1,101 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "event_loop_stats.h"
+
+namespace flutter {
+
+constexpr size_t Histogram::kBucketCount;
+constexpr size_t EventLoopStats::kWakeReasonCount;
+
+static const char* kWakeReasonNames[EventLoopStats::kWakeReasonCount] = {
+    "event", "wake", "deadline", "none"};
+
+size_t Histogram::BucketForValue(uint64_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  const size_t bucket = 64 - __builtin_clzll(value);
+  return bucket < kBucketCount ? bucket : kBucketCount - 1;
+}
+
+void Histogram::Add(uint64_t value) {
+  IncrementSingleWriter(buckets_[BucketForValue(value)]);
+  IncrementSingleWriter(count_);
+  sum_.store(sum_.load(std::memory_order_relaxed) + value,
+             std::memory_order_relaxed);
+  if (value > max_.load(std::memory_order_relaxed)) {
+    max_.store(value, std::memory_order_relaxed);
+  }
+}
+
+uint64_t Histogram::GetCount() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::GetMax() const {
+  return max_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::GetPercentileUpperBound(double percentile) const {
+  const uint64_t count = GetCount();
+  if (count == 0) {
+    return 0;
+  }
+
+  const uint64_t rank = static_cast<uint64_t>(count * percentile / 100.0);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBucketCount; i++) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen > rank) {
+      return i + 1 < kBucketCount ? (1ull << i) : GetMax();
+    }
+  }
+  return GetMax();
+}
+
+void Histogram::Dump(std::ostream& stream, const char* name) const {
+  const uint64_t count = GetCount();
+  stream << name << ": count=" << count;
+  if (count > 0) {
+    stream << " mean=" << sum_.load(std::memory_order_relaxed) / count
+           << " p50<=" << GetPercentileUpperBound(50)
+           << " p99<=" << GetPercentileUpperBound(99) << " max=" << GetMax();
+  }
+  stream << " |";
+  for (size_t i = 0; i < kBucketCount; i++) {
+    const uint64_t bucket = buckets_[i].load(std::memory_order_relaxed);
+    if (bucket == 0) {
+      continue;
+    }
+    if (i + 1 < kBucketCount) {
+      stream << " <" << (1ull << i) << ":" << bucket;
+    } else {
+      stream << " >=" << (1ull << (i - 1)) << ":" << bucket;
+    }
+  }
+  stream << std::endl;
+}
+
+void EventLoopStats::Dump(std::ostream& stream, const char* label) const {
+  stream << label << " tasks: posted=" << tasks_posted.load()
+         << " run=" << tasks_run.load()
+         << " budget_yields=" << budget_yields.load() << std::endl;
+
+  stream << label << " wakeups: total=" << wakeups.load()
+         << " spurious=" << spurious_wakeups.load();
+  for (size_t i = 0; i < kWakeReasonCount; i++) {
+    stream << " " << kWakeReasonNames[i] << "=" << wake_reasons[i].load();
+  }
+  stream << std::endl;
+
+  stream << label << " ";
+  lateness_us.Dump(stream, "lateness_us");
+  stream << label << " ";
+  execution_us.Dump(stream, "execution_us");
+  stream << label << " ";
+  queue_depth.Dump(stream, "queue_depth");
+}
+
+}  // namespace flutter
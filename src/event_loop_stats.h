@@ -0,0 +1,84 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <ostream>
+
+#include "macros.h"
+
+namespace flutter {
+
+// A histogram with fixed power-of-two buckets: [0, 1), [1, 2), [2, 4), ...
+// with the last bucket open ended.
+//
+// Add() must only be called from one thread. It uses relaxed loads and stores
+// rather than read-modify-write operations, so recording costs no more than
+// a plain increment. Any thread may read a (slightly torn) snapshot.
+class Histogram {
+ public:
+  static constexpr size_t kBucketCount = 20;
+
+  Histogram() = default;
+
+  void Add(uint64_t value);
+
+  uint64_t GetCount() const;
+
+  uint64_t GetMax() const;
+
+  // Returns the upper bound of the bucket containing the |percentile|th
+  // sample, which is within a factor of two of the true value.
+  uint64_t GetPercentileUpperBound(double percentile) const;
+
+  // Writes the non-empty buckets on one line, prefixed by |name|.
+  void Dump(std::ostream& stream, const char* name) const;
+
+ private:
+  std::atomic<uint64_t> buckets_[kBucketCount] = {};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+
+  static size_t BucketForValue(uint64_t value);
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(Histogram);
+};
+
+// Scheduling statistics for one EventLoop. Everything except |tasks_posted| is
+// recorded on the loop thread only.
+struct EventLoopStats {
+  // Number of WakeReason values in EventLoop.
+  static constexpr size_t kWakeReasonCount = 4;
+
+  std::atomic<uint64_t> tasks_posted{0};
+  std::atomic<uint64_t> tasks_run{0};
+  std::atomic<uint64_t> wakeups{0};
+  std::atomic<uint64_t> spurious_wakeups{0};
+  // Times draining paused to service pending events.
+  std::atomic<uint64_t> budget_yields{0};
+  std::atomic<uint64_t> wake_reasons[kWakeReasonCount] = {};
+
+  // How late tasks ran compared to their fire time, in microseconds.
+  Histogram lateness_us;
+  // How long each task took to run, in microseconds.
+  Histogram execution_us;
+  // Number of scheduled tasks each time the loop looked at its queue.
+  Histogram queue_depth;
+
+  // Writes all statistics to |stream|, prefixing each line with |label|.
+  void Dump(std::ostream& stream, const char* label) const;
+};
+
+// Increments a counter that only one thread ever writes.
+inline void IncrementSingleWriter(std::atomic<uint64_t>& counter) {
+  counter.store(counter.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+}
+
+}  // namespace flutter
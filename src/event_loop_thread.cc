@@ -0,0 +1,83 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "event_loop_thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <future>
+
+#include "wayland_event_loop.h"
+
+namespace flutter {
+
+EventLoopThread::EventLoopThread(
+    const std::string& name,
+    const EventLoop::TaskExpiredCallback& on_task_expired,
+    ClockDomain& clock_domain) {
+  if (!reactor_.IsValid()) {
+    return;
+  }
+
+  quit_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (quit_fd_ == -1) {
+    FLWAY_ERROR << "eventfd create failed: " << errno << std::endl;
+    return;
+  }
+  // The callback only has to end the wait; the loop checks |running_|.
+  reactor_.AddFd(quit_fd_, EPOLLIN, [](uint32_t events) {});
+
+  std::promise<void> ready;
+  auto ready_future = ready.get_future();
+  thread_ = std::thread([this, name, on_task_expired, &clock_domain,
+                         &ready]() {
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    // The loop must be created on the thread it runs tasks on.
+    event_loop_ = std::make_unique<WayLandEventLoop>(
+        std::this_thread::get_id(), on_task_expired, clock_domain, reactor_);
+    ready.set_value();
+
+    while (running_.load(std::memory_order_acquire)) {
+      event_loop_->WaitForEvents();
+    }
+  });
+  ready_future.wait();
+}
+
+EventLoopThread::~EventLoopThread() {
+  if (thread_.joinable()) {
+    running_.store(false, std::memory_order_release);
+    const uint64_t value = 1;
+    if (write(quit_fd_, &value, sizeof(value)) == -1) {
+      FLWAY_ERROR << "Could not stop the event loop thread: " << errno
+                  << std::endl;
+    }
+    thread_.join();
+  }
+
+  event_loop_.reset();
+
+  if (quit_fd_ != -1) {
+    reactor_.RemoveFd(quit_fd_);
+    close(quit_fd_);
+  }
+}
+
+bool EventLoopThread::IsValid() const {
+  return event_loop_ != nullptr;
+}
+
+EventLoop* EventLoopThread::GetEventLoop() const {
+  return event_loop_.get();
+}
+
+EpollReactor& EventLoopThread::GetReactor() {
+  return reactor_;
+}
+
+}  // namespace flutter
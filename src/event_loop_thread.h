@@ -0,0 +1,50 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "clock_domain.h"
+#include "epoll_reactor.h"
+#include "event_loop.h"
+#include "macros.h"
+
+namespace flutter {
+
+// A thread running its own event loop and reactor, for engine task runners
+// that must not share the platform thread.
+class EventLoopThread {
+ public:
+  // Starts a thread called |name| whose loop runs tasks with
+  // |on_task_expired|. Returns once the loop is ready to accept tasks.
+  EventLoopThread(const std::string& name,
+                  const EventLoop::TaskExpiredCallback& on_task_expired,
+                  ClockDomain& clock_domain);
+
+  // Stops the loop and joins the thread. Tasks still queued are dropped.
+  ~EventLoopThread();
+
+  bool IsValid() const;
+
+  EventLoop* GetEventLoop() const;
+
+  // Returns the reactor the thread waits on. Descriptors registered here have
+  // their callbacks run on this thread.
+  EpollReactor& GetReactor();
+
+ private:
+  EpollReactor reactor_;
+  std::unique_ptr<EventLoop> event_loop_;
+  std::atomic<bool> running_{true};
+  int quit_fd_ = -1;
+  std::thread thread_;
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(EventLoopThread);
+};
+
+}  // namespace flutter
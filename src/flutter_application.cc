@@ -8,17 +8,25 @@
 #include <sys/types.h>
 
 #include <chrono>
+#include <cstring>
 #include <sstream>
 #include <vector>
 
 #include "utils.h"
 #include "event_loop.h"
+#include "event_loop_thread.h"
 #include "wayland_event_loop.h"
 
 namespace flutter {
 
 static_assert(FLUTTER_ENGINE_VERSION == 1, "");
 
+static constexpr size_t kPlatformTaskRunnerIdentifier = 1;
+static constexpr size_t kRenderTaskRunnerIdentifier = 2;
+
+// Used when the render delegate cannot provide vsync itself.
+static constexpr std::chrono::nanoseconds kDefaultFramePeriod(16666667);
+
 static const char* kICUDataFileName = "icudtl.dat";
 
 static std::string GetICUDataPath() {
@@ -55,64 +63,152 @@ static void ConfigurePlatformTaskRunner(
     reinterpret_cast<FlutterApplication*>(state)->event_loop_->PostTask(
         task, target_time_nanos);
   };
+  task_runner->identifier = kPlatformTaskRunnerIdentifier;
+}
+
+// Populates |task_runner| with a description that runs tasks on |event_loop|,
+// which belongs to a thread owned by the embedder.
+static void ConfigureRenderTaskRunner(FlutterTaskRunnerDescription* task_runner,
+                                      EventLoop* event_loop) {
+  task_runner->struct_size = sizeof(FlutterTaskRunnerDescription);
+  task_runner->user_data = event_loop;
+  task_runner->runs_task_on_current_thread_callback = [](void* loop) -> bool {
+    return reinterpret_cast<EventLoop*>(loop)->RunsTasksOnCurrentThread();
+  };
+  task_runner->post_task_callback =
+      [](FlutterTask task, uint64_t target_time_nanos, void* loop) -> void {
+    reinterpret_cast<EventLoop*>(loop)->PostTask(task, target_time_nanos);
+  };
+  task_runner->identifier = kRenderTaskRunnerIdentifier;
 }
 
 FlutterApplication::FlutterApplication(
     std::string bundle_path,
     const std::vector<std::string>& command_line_args,
-    RenderDelegate& render_delegate)
+    RenderDelegate& render_delegate,
+    EpollReactor& reactor,
+    const std::string& persistent_cache_path)
     : render_delegate_(render_delegate) {
   if (!FlutterAssetBundleIsValid(bundle_path)) {
     FLWAY_ERROR << "Flutter asset bundle was not valid." << std::endl;
     return;
   }
 
-  // Create an event loop for the window. It is not running yet.
-  auto event_loop = std::make_unique<flutter::WayLandEventLoop>(
-      std::this_thread::get_id(),  // main wayland thread
+  const EventLoop::TaskExpiredCallback run_engine_task =
       [engine = &engine_](const auto* task) {
         if (FlutterEngineRunTask(*engine, task) != kSuccess) {
           FLWAY_ERROR << "Could not post an engine task." << std::endl;
         }
         // FLWAY_ERROR << "DEBUG:excute an engine task." << std::endl;
-      }, reinterpret_cast<WaylandDisplay*>(&render_delegate));
+      };
+
+  // Create an event loop for the window. It is not running yet.
+  auto event_loop = std::make_unique<flutter::WayLandEventLoop>(
+      std::this_thread::get_id(),  // main wayland thread
+      run_engine_task, clock_domain_, reactor,
+      render_delegate.OnApplicationGetWaylandDisplay(),
+      [&render_delegate]() {
+        render_delegate.OnApplicationWaylandDisplayLost();
+      });
+  if (!event_loop->IsValid()) {
+    FLWAY_ERROR << "Could not create the platform event loop." << std::endl;
+    return;
+  }
+
+  // Rasterization, context switches and buffer swaps happen on a thread of
+  // their own so that a blocking eglSwapBuffers never holds up Wayland input
+  // dispatch on the platform thread.
+  render_thread_ = std::make_unique<EventLoopThread>(
+      "flutter.render", run_engine_task, clock_domain_);
+  if (!render_thread_->IsValid()) {
+    FLWAY_ERROR << "Could not start the render thread." << std::endl;
+    return;
+  }
 
   // Configure a task runner using the event loop.
   event_loop_ = std::move(event_loop);
   FlutterTaskRunnerDescription platform_task_runner = {};
   ConfigurePlatformTaskRunner(&platform_task_runner, this);
+  FlutterTaskRunnerDescription render_task_runner = {};
+  ConfigureRenderTaskRunner(&render_task_runner,
+                            render_thread_->GetEventLoop());
   FlutterCustomTaskRunners task_runners = {};
   task_runners.struct_size = sizeof(FlutterCustomTaskRunners);
   task_runners.platform_task_runner = &platform_task_runner;
+  task_runners.render_task_runner = &render_task_runner;
 
   FlutterRendererConfig config = {};
-  config.type = kOpenGL;
-  config.open_gl.struct_size = sizeof(config.open_gl);
-  config.open_gl.make_current = [](void* userdata) -> bool {
-    return reinterpret_cast<FlutterApplication*>(userdata)
-        ->render_delegate_.OnApplicationContextMakeCurrent();
-  };
-  config.open_gl.clear_current = [](void* userdata) -> bool {
-    return reinterpret_cast<FlutterApplication*>(userdata)
-        ->render_delegate_.OnApplicationContextClearCurrent();
-  };
-  config.open_gl.present = [](void* userdata) -> bool {
-    return reinterpret_cast<FlutterApplication*>(userdata)
-        ->render_delegate_.OnApplicationPresent();
-  };
-  config.open_gl.fbo_callback = [](void* userdata) -> uint32_t {
-    return reinterpret_cast<FlutterApplication*>(userdata)
-        ->render_delegate_.OnApplicationGetOnscreenFBO();
-  };
-  config.open_gl.gl_proc_resolver = [](void* userdata,
-                                       const char* name) -> void* {
-    auto address = eglGetProcAddress(name);
-    if (address != nullptr) {
-      return reinterpret_cast<void*>(address);
+  if (render_delegate_.OnApplicationGetRendererType() == kSoftware) {
+    config.type = kSoftware;
+    config.software.struct_size = sizeof(config.software);
+    config.software.surface_present_callback =
+        [](void* userdata, const void* allocation, size_t row_bytes,
+           size_t height) -> bool {
+      return reinterpret_cast<FlutterApplication*>(userdata)
+          ->render_delegate_.OnApplicationPresentSoftware(allocation,
+                                                          row_bytes, height);
+    };
+  } else {
+    config.type = kOpenGL;
+    config.open_gl.struct_size = sizeof(config.open_gl);
+    // The context is made current for every frame, which is when textures
+    // unregistered since the last one are cleaned up.
+    config.open_gl.make_current = [](void* userdata) -> bool {
+      auto application = reinterpret_cast<FlutterApplication*>(userdata);
+      if (!application->render_delegate_.OnApplicationContextMakeCurrent()) {
+        return false;
+      }
+      application->texture_registrar_->DeleteUnregisteredTextures();
+      return true;
+    };
+    config.open_gl.clear_current = [](void* userdata) -> bool {
+      return reinterpret_cast<FlutterApplication*>(userdata)
+          ->render_delegate_.OnApplicationContextClearCurrent();
+    };
+    config.open_gl.make_resource_current = [](void* userdata) -> bool {
+      return reinterpret_cast<FlutterApplication*>(userdata)
+          ->render_delegate_.OnApplicationMakeResourceCurrent();
+    };
+    // Only one of present and present_with_info may be set. The latter
+    // carries the frame damage, which lets the compositor recomposite less.
+    config.open_gl.present_with_info =
+        [](void* userdata, const FlutterPresentInfo* info) -> bool {
+      return reinterpret_cast<FlutterApplication*>(userdata)
+          ->render_delegate_.OnApplicationPresentWithDamage(
+              info->frame_damage.damage, info->frame_damage.num_rects);
+    };
+    config.open_gl.fbo_with_frame_info_callback =
+        [](void* userdata, const FlutterFrameInfo* frame_info) -> uint32_t {
+      return reinterpret_cast<FlutterApplication*>(userdata)
+          ->render_delegate_.OnApplicationGetOnscreenFBOWithSize(
+              frame_info->size.width, frame_info->size.height);
+    };
+    if (render_delegate_.OnApplicationSupportsPartialRepaint()) {
+      config.open_gl.populate_existing_damage =
+          [](void* userdata, intptr_t fbo_id, FlutterDamage* existing_damage) {
+            reinterpret_cast<FlutterApplication*>(userdata)
+                ->render_delegate_.OnApplicationPopulateExistingDamage(
+                    existing_damage);
+          };
     }
-    FLWAY_ERROR << "Tried unsuccessfully to resolve: " << name << std::endl;
-    return nullptr;
-  };
+    texture_registrar_ = std::make_unique<TextureRegistrar>(&engine_);
+    config.open_gl.gl_external_texture_frame_callback =
+        [](void* userdata, int64_t texture_id, size_t width, size_t height,
+           FlutterOpenGLTexture* texture) -> bool {
+      return reinterpret_cast<FlutterApplication*>(userdata)
+          ->texture_registrar_->PopulateTexture(texture_id, width, height,
+                                                texture);
+    };
+    config.open_gl.gl_proc_resolver = [](void* userdata,
+                                         const char* name) -> void* {
+      auto address = eglGetProcAddress(name);
+      if (address != nullptr) {
+        return reinterpret_cast<void*>(address);
+      }
+      FLWAY_ERROR << "Tried unsuccessfully to resolve: " << name << std::endl;
+      return nullptr;
+    };
+  }
 
   auto icu_data_path = GetICUDataPath();
 
@@ -139,6 +235,19 @@ FlutterApplication::FlutterApplication(
       .command_line_argv = command_line_args_c.data(),
   };
   args.custom_task_runners = &task_runners;
+  args.compositor = render_delegate_.OnApplicationGetCompositor();
+  if (!persistent_cache_path.empty()) {
+    args.persistent_cache_path = persistent_cache_path.c_str();
+    args.is_persistent_cache_read_only = false;
+  }
+  args.vsync_callback = [](void* userdata, intptr_t baton) -> void {
+    auto application = reinterpret_cast<FlutterApplication*>(userdata);
+    if (application->render_delegate_.OnApplicationVsync(baton)) {
+      return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    application->OnVsync(baton, now, now + kDefaultFramePeriod);
+  };
 
   FlutterEngine engine = nullptr;
   auto result = FlutterEngineRun(FLUTTER_ENGINE_VERSION, &config, &args,
@@ -168,19 +277,73 @@ bool FlutterApplication::IsValid() const {
   return valid_;
 }
 
-bool FlutterApplication::SetWindowSize(size_t width, size_t height) {
+bool FlutterApplication::SetWindowSize(size_t width,
+                                       size_t height,
+                                       double pixel_ratio) {
   FlutterWindowMetricsEvent event = {};
   event.struct_size = sizeof(event);
   event.width = width;
   event.height = height;
-  event.pixel_ratio = 1.0;
+  event.pixel_ratio = pixel_ratio;
   return FlutterEngineSendWindowMetricsEvent(engine_, &event) == kSuccess;
 }
 
+void FlutterApplication::DumpEventLoopStats(std::ostream& stream) const {
+  if (event_loop_) {
+    event_loop_->GetStats().Dump(stream, "[platform]");
+  }
+  if (render_thread_ && render_thread_->IsValid()) {
+    render_thread_->GetEventLoop()->GetStats().Dump(stream, "[render]");
+  }
+}
+
+bool FlutterApplication::OnVsync(
+    intptr_t baton,
+    std::chrono::steady_clock::time_point frame_start,
+    std::chrono::steady_clock::time_point frame_target) {
+  return FlutterEngineOnVsync(engine_, baton,
+                              clock_domain_.ToEngineTime(frame_start),
+                              clock_domain_.ToEngineTime(frame_target)) ==
+         kSuccess;
+}
+
 void FlutterApplication::ProcessEvents() {
   __FlutterEngineFlushPendingTasksNow();
 }
 
+bool FlutterApplication::SendLifecycleState(LifecycleState state) {
+  if (!valid_) {
+    FLWAY_ERROR << "Lifecycle changes on an invalid application." << std::endl;
+    return false;
+  }
+
+  // The channel uses the string codec, which is plain UTF-8.
+  const char* message = nullptr;
+  switch (state) {
+    case LifecycleState::resumed:
+      message = "AppLifecycleState.resumed";
+      break;
+    case LifecycleState::inactive:
+      message = "AppLifecycleState.inactive";
+      break;
+    case LifecycleState::paused:
+      message = "AppLifecycleState.paused";
+      break;
+  }
+
+  FlutterPlatformMessage platform_message = {};
+  platform_message.struct_size = sizeof(FlutterPlatformMessage);
+  platform_message.channel = "flutter/lifecycle";
+  platform_message.message = reinterpret_cast<const uint8_t*>(message);
+  platform_message.message_size = strlen(message);
+  return FlutterEngineSendPlatformMessage(engine_, &platform_message) ==
+         kSuccess;
+}
+
+TextureRegistrar* FlutterApplication::GetTextureRegistrar() {
+  return texture_registrar_.get();
+}
+
 bool FlutterApplication::SendPointerEvent(int button, int x, int y) {
   if (!valid_) {
     FLWAY_ERROR << "Pointer events on an invalid application." << std::endl;
@@ -216,10 +379,7 @@ bool FlutterApplication::SendFlutterPointerEvent(FlutterPointerPhase phase,
   event.y = y;
   event.device_kind = kFlutterPointerDeviceKindMouse;
   event.buttons = kFlutterPointerButtonMousePrimary;
-  event.timestamp =
-      std::chrono::duration_cast<std::chrono::microseconds>(
-          std::chrono::high_resolution_clock::now().time_since_epoch())
-          .count();
+  event.timestamp = clock_domain_.EngineNow() / 1000;
   //FLWAY_LOG << "[M]" << phase << "," << x << "," << y << std::endl;
   return FlutterEngineSendPointerEvent(engine_, &event, 1) == kSuccess;
 }
@@ -263,10 +423,7 @@ bool FlutterApplication::SendFlutterTouchEvent(FlutterPointerPhase phase,
   event.x = x;
   event.y = y;
   event.device_kind = kFlutterPointerDeviceKindTouch;
-  event.timestamp =
-      std::chrono::duration_cast<std::chrono::microseconds>(
-          std::chrono::high_resolution_clock::now().time_since_epoch())
-          .count();
+  event.timestamp = clock_domain_.EngineNow() / 1000;
   //FLWAY_LOG << "[T]" << phase << "," << x << "," << y << std::endl;
   return FlutterEngineSendPointerEvent(engine_, &event, 1) == kSuccess;
 }
@@ -6,11 +6,20 @@
 
 #include <flutter_embedder.h>
 
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <ostream>
 #include <vector>
 
 #include "macros.h"
+#include "clock_domain.h"
+#include "epoll_reactor.h"
 #include "event_loop.h"
+#include "event_loop_thread.h"
+#include "texture_registrar.h"
+
+struct wl_display;
 
 namespace flutter {
 
@@ -23,22 +32,105 @@ enum class EventPhase : int
     cancel,
 };
 
+// Mirrors the framework's AppLifecycleState.
+enum class LifecycleState : int
+{
+    resumed,
+    inactive,
+    paused,
+};
+
 class FlutterApplication {
  public:
+  // Context, present and FBO callbacks are invoked on the render thread.
   class RenderDelegate {
    public:
+    // Which of the engine's renderers to configure. Asked once, when the
+    // engine is started. The software renderer only ever calls
+    // OnApplicationPresentSoftware, the OpenGL one never does.
+    virtual FlutterRendererType OnApplicationGetRendererType() {
+      return kOpenGL;
+    }
+
     virtual bool OnApplicationContextMakeCurrent() = 0;
 
     virtual bool OnApplicationContextClearCurrent() = 0;
 
+    // Makes a context sharing the onscreen context's objects current on the
+    // calling thread, so the engine can upload textures off the render thread.
+    // Returning false makes the engine upload on the render thread instead.
+    virtual bool OnApplicationMakeResourceCurrent() { return false; }
+
     virtual bool OnApplicationPresent() = 0;
 
+    // Presents a frame in which only the |damage_count| rectangles in
+    // |damage| changed since the previous one. The rectangles are in surface
+    // pixels with a top-left origin. No rectangles means the whole surface.
+    virtual bool OnApplicationPresentWithDamage(const FlutterRect* damage,
+                                                size_t damage_count) {
+      return OnApplicationPresent();
+    }
+
     virtual uint32_t OnApplicationGetOnscreenFBO() = 0;
+
+    // Like OnApplicationGetOnscreenFBO, for a frame of |width| by |height|
+    // pixels. Called before every frame, so the onscreen surface can follow
+    // window size changes.
+    virtual uint32_t OnApplicationGetOnscreenFBOWithSize(size_t width,
+                                                         size_t height) {
+      return OnApplicationGetOnscreenFBO();
+    }
+
+    // Presents a frame rasterized by the software renderer. |allocation| holds
+    // |height| rows of |row_bytes| bytes of premultiplied 32-bit BGRA pixels
+    // and is only valid for the duration of the call.
+    virtual bool OnApplicationPresentSoftware(const void* allocation,
+                                              size_t row_bytes,
+                                              size_t height) {
+      return false;
+    }
+
+    // Whether the delegate knows which parts of its back buffers are out of
+    // date. Asked once, when the engine is started. If so, the engine only
+    // rasterizes the regions reported by OnApplicationPopulateExistingDamage.
+    virtual bool OnApplicationSupportsPartialRepaint() { return false; }
+
+    // Fills |existing_damage| with the regions of the next back buffer that
+    // do not hold the previous frame. The rectangles must stay valid until the
+    // frame is presented.
+    virtual void OnApplicationPopulateExistingDamage(
+        FlutterDamage* existing_damage) {}
+
+    // Asks the delegate to answer |baton| through FlutterApplication::OnVsync
+    // at the next vsync. Returning false makes the application answer it right
+    // away.
+    virtual bool OnApplicationVsync(intptr_t baton) { return false; }
+
+    // Returns the compositor the engine presents its layers through, or
+    // nullptr to have them flattened into the onscreen framebuffer. Asked
+    // once, when the engine is started, and must outlive it.
+    virtual const FlutterCompositor* OnApplicationGetCompositor() {
+      return nullptr;
+    }
+
+    // Returns the Wayland connection for the platform thread to dispatch, or
+    // nullptr when rendering without one. Asked once, at construction.
+    virtual wl_display* OnApplicationGetWaylandDisplay() { return nullptr; }
+
+    // Tells the delegate its Wayland connection broke, e.g. because the
+    // compositor went away. It is no longer dispatched. Called on the
+    // platform thread.
+    virtual void OnApplicationWaylandDisplayLost() {}
   };
 
+  // Platform tasks are scheduled on |reactor|, which must be waited on from
+  // the thread creating the application and outlive it. The engine keeps
+  // compiled shaders in |persistent_cache_path| across launches, if given.
   FlutterApplication(std::string bundle_path,
                      const std::vector<std::string>& args,
-                     RenderDelegate& render_delegate);
+                     RenderDelegate& render_delegate,
+                     EpollReactor& reactor,
+                     const std::string& persistent_cache_path = "");
 
   ~FlutterApplication();
   std::unique_ptr<flutter::EventLoop> event_loop_;
@@ -47,7 +139,25 @@ class FlutterApplication {
 
   void ProcessEvents();
 
-  bool SetWindowSize(size_t width, size_t height);
+  // Sets the size of the window in physical pixels, and how many of those
+  // make up a logical pixel.
+  bool SetWindowSize(size_t width, size_t height, double pixel_ratio = 1.0);
+
+  // Writes the statistics of the platform and render event loops to |stream|.
+  void DumpEventLoopStats(std::ostream& stream) const;
+
+  // Answers a vsync request from the engine. Safe to call from any thread.
+  bool OnVsync(intptr_t baton,
+               std::chrono::steady_clock::time_point frame_start,
+               std::chrono::steady_clock::time_point frame_target);
+
+  // Tells the framework over flutter/lifecycle. Must be called on the
+  // platform thread.
+  bool SendLifecycleState(LifecycleState state);
+
+  // Returns the registrar producers hand external texture frames to, or
+  // nullptr with the software renderer.
+  TextureRegistrar* GetTextureRegistrar();
 
   bool SendPointerEvent(int button, int x, int y);
   bool SendTouchEvent(EventPhase phase, int x, int y);
@@ -55,7 +165,14 @@ class FlutterApplication {
  private:
   bool valid_;
   RenderDelegate& render_delegate_;
+  // The single mapping between engine time and the embedder's steady clock.
+  // Task scheduling and event timestamps all go through it.
+  ClockDomain clock_domain_;
+  // Runs the engine's render task runner. Must outlive the engine.
+  std::unique_ptr<EventLoopThread> render_thread_;
   FlutterEngine engine_ = nullptr;
+  // OpenGL renderer only. Must outlive the engine.
+  std::unique_ptr<TextureRegistrar> texture_registrar_;
   int last_button_ = 0;
 
   bool SendFlutterPointerEvent(FlutterPointerPhase phase, double x, double y);
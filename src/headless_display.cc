@@ -0,0 +1,451 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "headless_display.h"
+
+#include <EGL/eglext.h>
+#include <GLES2/gl2ext.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iomanip>
+
+#include "utils.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+namespace flutter {
+
+constexpr std::chrono::nanoseconds HeadlessDisplay::kWarmupFramePeriod;
+
+static double ToMilliseconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void HeadlessDisplay::PhaseStats::Add(Clock::duration duration) {
+  total += duration;
+  max = std::max(max, duration);
+}
+
+HeadlessDisplay::HeadlessDisplay(EpollReactor& reactor,
+                                 size_t width,
+                                 size_t height,
+                                 const EmbedderOptions& options)
+    : reactor_(reactor),
+      width_(width),
+      height_(height),
+      warmup_(options.warmup) {
+  if (width_ == 0 || height_ == 0) {
+    FLWAY_ERROR << "Invalid screen dimensions." << std::endl;
+    return;
+  }
+
+  if (warmup_ && !options.warmup_script.empty() &&
+      !warmup_script_.Load(options.warmup_script)) {
+    return;
+  }
+
+  if (warmup_) {
+    // Leaves time for whatever the last event set off to settle.
+    static constexpr uint64_t kWarmupSettleFrames = 120;
+    warmup_end_frame_ = options.headless_frames;
+    if (warmup_end_frame_ == 0) {
+      warmup_end_frame_ = warmup_script_.GetLastFrame() + kWarmupSettleFrames;
+    }
+    if (!StartWarmupTimer()) {
+      return;
+    }
+  } else {
+    frame_limit_ = options.headless_frames;
+  }
+
+  // Without frame callbacks, the waiter falls back to its timer and ticks at
+  // the default refresh period.
+  vsync_waiter_ = std::make_unique<VsyncWaiter>(
+      reactor, [this](intptr_t baton, VsyncWaiter::TimePoint frame_start,
+                      VsyncWaiter::TimePoint frame_target) {
+        if (application == nullptr) {
+          FLWAY_ERROR << "Not exist an application to send vsync." << std::endl;
+          return;
+        }
+        vsync_start_.store(frame_start.time_since_epoch().count(),
+                           std::memory_order_relaxed);
+        application->OnVsync(baton, frame_start, frame_target);
+      });
+
+  if (!vsync_waiter_->IsValid()) {
+    FLWAY_ERROR << "Could not create the vsync waiter." << std::endl;
+    return;
+  }
+
+  if (!SetupEGL()) {
+    FLWAY_ERROR << "Could not setup headless EGL." << std::endl;
+    return;
+  }
+
+  valid_ = true;
+}
+
+HeadlessDisplay::~HeadlessDisplay() {
+  if (frame_count_ > 0 && (frame_limit_ == 0 || frame_count_ < frame_limit_)) {
+    LogSummary();
+  }
+
+  if (warmup_timer_fd_ != -1) {
+    reactor_.RemoveFd(warmup_timer_fd_);
+    close(warmup_timer_fd_);
+  }
+
+  // The framebuffer goes with the context.
+  if (egl_resource_context_ != EGL_NO_CONTEXT) {
+    eglDestroyContext(egl_display_, egl_resource_context_);
+  }
+
+  if (egl_context_ != EGL_NO_CONTEXT) {
+    eglDestroyContext(egl_display_, egl_context_);
+  }
+
+  if (egl_resource_surface_ != EGL_NO_SURFACE) {
+    eglDestroySurface(egl_display_, egl_resource_surface_);
+  }
+
+  if (egl_surface_ != EGL_NO_SURFACE) {
+    eglDestroySurface(egl_display_, egl_surface_);
+  }
+
+  if (egl_display_ != EGL_NO_DISPLAY) {
+    eglTerminate(egl_display_);
+  }
+}
+
+bool HeadlessDisplay::IsValid() const {
+  return valid_.load(std::memory_order_relaxed);
+}
+
+bool HeadlessDisplay::SendInitialWindowSize() {
+  if (application == nullptr) {
+    return false;
+  }
+  return application->SetWindowSize(width_, height_);
+}
+
+bool HeadlessDisplay::SetupEGL() {
+  // Prefer a display that does not need a window system at all. Otherwise,
+  // the default one still renders to pbuffers.
+  const char* client_extensions =
+      eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (HasEGLExtension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+    auto get_platform_display =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (get_platform_display != nullptr) {
+      egl_display_ = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                          EGL_DEFAULT_DISPLAY, nullptr);
+    }
+  }
+
+  if (egl_display_ == EGL_NO_DISPLAY) {
+    egl_display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  if (egl_display_ == EGL_NO_DISPLAY ||
+      eglInitialize(egl_display_, nullptr, nullptr) != EGL_TRUE) {
+    FLWAY_ERROR << "Could not initialize a headless EGL display."
+                << std::endl;
+    egl_display_ = EGL_NO_DISPLAY;
+    return false;
+  }
+
+  if (eglBindAPI(EGL_OPENGL_ES_API) != EGL_TRUE) {
+    FLWAY_ERROR << "Could not bind the ES API." << std::endl;
+    return false;
+  }
+
+  EGLint attribs[] = {
+      // clang-format off
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+      EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+      EGL_RED_SIZE,        8,
+      EGL_GREEN_SIZE,      8,
+      EGL_BLUE_SIZE,       8,
+      EGL_ALPHA_SIZE,      8,
+      EGL_NONE,            // termination sentinel
+      // clang-format on
+  };
+
+  EGLConfig egl_config = nullptr;
+  EGLint config_count = 0;
+  if (eglChooseConfig(egl_display_, attribs, &egl_config, 1,
+                      &config_count) != EGL_TRUE ||
+      config_count == 0) {
+    FLWAY_ERROR << "No matching headless configs." << std::endl;
+    return false;
+  }
+
+  const EGLint context_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+  egl_context_ = eglCreateContext(egl_display_, egl_config, EGL_NO_CONTEXT,
+                                  context_attribs);
+  egl_resource_context_ = eglCreateContext(egl_display_, egl_config,
+                                           egl_context_, context_attribs);
+  if (egl_context_ == EGL_NO_CONTEXT ||
+      egl_resource_context_ == EGL_NO_CONTEXT) {
+    FLWAY_ERROR << "Could not create the headless contexts." << std::endl;
+    return false;
+  }
+
+  // The engine renders into a framebuffer object either way. The surfaces
+  // only give the contexts something to be current with.
+  const bool surfaceless =
+      HasEGLExtension(eglQueryString(egl_display_, EGL_EXTENSIONS),
+                      "EGL_KHR_surfaceless_context");
+  if (!surfaceless) {
+    const EGLint surface_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    egl_surface_ =
+        eglCreatePbufferSurface(egl_display_, egl_config, surface_attribs);
+    egl_resource_surface_ =
+        eglCreatePbufferSurface(egl_display_, egl_config, surface_attribs);
+    if (egl_surface_ == EGL_NO_SURFACE ||
+        egl_resource_surface_ == EGL_NO_SURFACE) {
+      FLWAY_ERROR << "Could not create the headless pbuffers." << std::endl;
+      return false;
+    }
+  }
+
+  FLWAY_LOG << "Rendering headless with "
+            << (surfaceless ? "surfaceless contexts." : "pbuffers.")
+            << std::endl;
+  return true;
+}
+
+bool HeadlessDisplay::ResizeFramebuffer(size_t width, size_t height) {
+  DestroyFramebuffer();
+
+  glGenRenderbuffers(1, &color_renderbuffer_);
+  glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8_OES, width, height);
+
+  // The engine clips with the stencil buffer, like on an onscreen surface.
+  glGenRenderbuffers(1, &stencil_renderbuffer_);
+  glBindRenderbuffer(GL_RENDERBUFFER, stencil_renderbuffer_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &framebuffer_);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color_renderbuffer_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, stencil_renderbuffer_);
+  const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    FLWAY_ERROR << "Could not create the headless framebuffer: " << status
+                << std::endl;
+    DestroyFramebuffer();
+    return false;
+  }
+
+  framebuffer_width_ = width;
+  framebuffer_height_ = height;
+  return true;
+}
+
+void HeadlessDisplay::DestroyFramebuffer() {
+  if (framebuffer_ != 0) {
+    glDeleteFramebuffers(1, &framebuffer_);
+    framebuffer_ = 0;
+  }
+  if (color_renderbuffer_ != 0) {
+    glDeleteRenderbuffers(1, &color_renderbuffer_);
+    color_renderbuffer_ = 0;
+  }
+  if (stencil_renderbuffer_ != 0) {
+    glDeleteRenderbuffers(1, &stencil_renderbuffer_);
+    stencil_renderbuffer_ = 0;
+  }
+  framebuffer_width_ = 0;
+  framebuffer_height_ = 0;
+}
+
+bool HeadlessDisplay::StartWarmupTimer() {
+  warmup_timer_fd_ =
+      timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (warmup_timer_fd_ == -1) {
+    FLWAY_ERROR << "Could not create the warmup timer: " << errno
+                << std::endl;
+    return false;
+  }
+
+  if (!reactor_.AddFd(warmup_timer_fd_, EPOLLIN,
+                      [this](uint32_t events) { OnWarmupTimerFired(); })) {
+    close(warmup_timer_fd_);
+    warmup_timer_fd_ = -1;
+    return false;
+  }
+
+  // Ticks once a refresh period from now on, like a display would.
+  itimerspec spec = {};
+  spec.it_value.tv_nsec = kWarmupFramePeriod.count();
+  spec.it_interval.tv_nsec = kWarmupFramePeriod.count();
+  if (timerfd_settime(warmup_timer_fd_, 0, &spec, nullptr) == -1) {
+    FLWAY_ERROR << "Could not arm the warmup timer: " << errno << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void HeadlessDisplay::OnWarmupTimerFired() {
+  uint64_t expirations = 0;
+  if (read(warmup_timer_fd_, &expirations, sizeof(expirations)) == -1) {
+    return;
+  }
+
+  // The script starts with the application.
+  if (application == nullptr || !valid_) {
+    return;
+  }
+
+  warmup_script_.Replay(warmup_frame_, *application);
+  warmup_frame_ += expirations;
+
+  if (warmup_frame_ >= warmup_end_frame_) {
+    itimerspec spec = {};
+    timerfd_settime(warmup_timer_fd_, 0, &spec, nullptr);
+    valid_ = false;
+    application->event_loop_->WakeUp();
+  }
+}
+
+void HeadlessDisplay::LogSummary() const {
+  const auto elapsed = Clock::now() - first_present_;
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  const double frames = static_cast<double>(frame_count_);
+  FLWAY_LOG << std::fixed << std::setprecision(2) << frame_count_
+            << " frames, " << (seconds > 0 ? (frames - 1) / seconds : 0.0)
+            << " frames per second. Average (max) build "
+            << ToMilliseconds(build_stats_.total) / frames << " ("
+            << ToMilliseconds(build_stats_.max) << ") ms, raster "
+            << ToMilliseconds(raster_stats_.total) / frames << " ("
+            << ToMilliseconds(raster_stats_.max) << ") ms, present "
+            << ToMilliseconds(present_stats_.total) / frames << " ("
+            << ToMilliseconds(present_stats_.max) << ") ms." << std::endl;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool HeadlessDisplay::OnApplicationContextMakeCurrent() {
+  if (eglMakeCurrent(egl_display_, egl_surface_, egl_surface_, egl_context_) !=
+      EGL_TRUE) {
+    FLWAY_ERROR << "Could not make the headless context current."
+                << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool HeadlessDisplay::OnApplicationContextClearCurrent() {
+  if (eglMakeCurrent(egl_display_, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                     EGL_NO_CONTEXT) != EGL_TRUE) {
+    FLWAY_ERROR << "Could not clear the context." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool HeadlessDisplay::OnApplicationMakeResourceCurrent() {
+  if (eglMakeCurrent(egl_display_, egl_resource_surface_,
+                     egl_resource_surface_,
+                     egl_resource_context_) != EGL_TRUE) {
+    FLWAY_ERROR << "Could not make the resource context current."
+                << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool HeadlessDisplay::OnApplicationPresent() {
+  // Stands in for the swap. Waiting for the GPU makes the raster time cover
+  // the actual rendering instead of just submitting it.
+  const auto present_start = Clock::now();
+  glFinish();
+  const auto present_end = Clock::now();
+
+  const auto build_time = raster_start_ - build_start_;
+  const auto raster_time = present_start - raster_start_;
+  const auto present_time = present_end - present_start;
+  build_stats_.Add(build_time);
+  raster_stats_.Add(raster_time);
+  present_stats_.Add(present_time);
+
+  if (frame_count_++ == 0) {
+    first_present_ = present_end;
+    rate_start_ = present_end;
+  }
+
+  FLWAY_LOG << std::fixed << std::setprecision(2) << "Frame " << frame_count_
+            << ": build " << ToMilliseconds(build_time) << " ms, raster "
+            << ToMilliseconds(raster_time) << " ms, present "
+            << ToMilliseconds(present_time) << " ms." << std::endl;
+
+  rate_frames_++;
+  const auto rate_elapsed = present_end - rate_start_;
+  if (rate_elapsed >= std::chrono::seconds(1)) {
+    FLWAY_LOG << std::fixed << std::setprecision(1)
+              << rate_frames_ / std::chrono::duration<double>(rate_elapsed)
+                                    .count()
+              << " frames per second." << std::endl;
+    rate_start_ = present_end;
+    rate_frames_ = 0;
+  }
+
+  if (frame_limit_ != 0 && frame_count_ == frame_limit_) {
+    LogSummary();
+    valid_ = false;
+    // The platform thread waits without a timeout and has to check again.
+    application->event_loop_->WakeUp();
+  }
+
+  return true;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+uint32_t HeadlessDisplay::OnApplicationGetOnscreenFBO() {
+  return framebuffer_;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+uint32_t HeadlessDisplay::OnApplicationGetOnscreenFBOWithSize(size_t width,
+                                                              size_t height) {
+  // The engine is asked for a frame at a vsync and rasterizes it as soon as
+  // it is built. The latest vsync is the one it was started at, unless the
+  // next one already fired while it was being built.
+  raster_start_ = Clock::now();
+  build_start_ = Clock::time_point(
+      Clock::duration(vsync_start_.load(std::memory_order_relaxed)));
+  if (build_start_ > raster_start_) {
+    build_start_ = raster_start_;
+  }
+
+  if ((width != framebuffer_width_ || height != framebuffer_height_) &&
+      !ResizeFramebuffer(width, height)) {
+    return 0;
+  }
+  return framebuffer_;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool HeadlessDisplay::OnApplicationVsync(intptr_t baton) {
+  vsync_waiter_->AwaitVsync(baton);
+  return true;
+}
+
+}  // namespace flutter
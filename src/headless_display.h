@@ -0,0 +1,155 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ostream>
+
+#include "embedder_options.h"
+#include "epoll_reactor.h"
+#include "flutter_application.h"
+#include "macros.h"
+#include "vsync_waiter.h"
+#include "warmup_script.h"
+
+namespace flutter {
+
+// Renders offscreen without a Wayland compositor, for benchmarks.
+//
+// Frames go to a framebuffer object on a surfaceless EGL context, or one
+// bound to a 1x1 pbuffer where surfaceless contexts are not supported. Mesa's
+// llvmpipe is enough. Vsync is synthesized at 60 Hz. Every frame's timings
+// are logged, along with the frame rate once a second.
+//
+// In warmup mode, a script of touch events is replayed along the way.
+class HeadlessDisplay : public FlutterApplication::RenderDelegate {
+ public:
+  // Vsync and warmup timers are scheduled on |reactor|, which must be waited
+  // on from the thread running the application and outlive it.
+  HeadlessDisplay(EpollReactor& reactor,
+                  size_t width,
+                  size_t height,
+                  const EmbedderOptions& options);
+
+  ~HeadlessDisplay();
+
+  // Turns false once the requested number of frames has been presented, or
+  // in warmup mode, once the run is over.
+  bool IsValid() const;
+
+  FlutterApplication* application = nullptr;
+
+  // Sends the window size to |application|, which must have been set.
+  bool SendInitialWindowSize();
+
+  // Frame timings are logged as they happen. Nothing else to dump.
+  void DumpStats(std::ostream& stream) const {}
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // Durations of one phase of the frames presented so far.
+  struct PhaseStats {
+    Clock::duration total = Clock::duration::zero();
+    Clock::duration max = Clock::duration::zero();
+
+    void Add(Clock::duration duration);
+  };
+
+  // Period of the frames the warmup script counts in.
+  static constexpr std::chrono::nanoseconds kWarmupFramePeriod =
+      std::chrono::nanoseconds(16666667);
+
+  EpollReactor& reactor_;
+  std::atomic<bool> valid_{false};
+  const size_t width_;
+  const size_t height_;
+  // Frames to present before turning invalid. Zero for no limit. Not used in
+  // warmup mode, which ends on time instead.
+  uint64_t frame_limit_ = 0;
+  std::unique_ptr<VsyncWaiter> vsync_waiter_;
+
+  // Warmup mode only. The script is replayed on the platform thread from a
+  // timer of its own, whether or not the engine asks for frames, and the run
+  // ends once |warmup_end_frame_| periods have passed.
+  bool warmup_ = false;
+  WarmupScript warmup_script_;
+  int warmup_timer_fd_ = -1;
+  uint64_t warmup_frame_ = 0;
+  uint64_t warmup_end_frame_ = 0;
+
+  EGLDisplay egl_display_ = EGL_NO_DISPLAY;
+  EGLContext egl_context_ = EGL_NO_CONTEXT;
+  EGLContext egl_resource_context_ = EGL_NO_CONTEXT;
+  // Only without surfaceless contexts. One for each context, as an EGL
+  // surface may only be current to one thread at a time.
+  EGLSurface egl_surface_ = EGL_NO_SURFACE;
+  EGLSurface egl_resource_surface_ = EGL_NO_SURFACE;
+
+  // The render target. Only touched on the render thread.
+  GLuint framebuffer_ = 0;
+  GLuint color_renderbuffer_ = 0;
+  GLuint stencil_renderbuffer_ = 0;
+  size_t framebuffer_width_ = 0;
+  size_t framebuffer_height_ = 0;
+
+  // Start of the vsync interval last handed to the engine, in nanoseconds of
+  // the steady clock. Written on the platform thread.
+  std::atomic<int64_t> vsync_start_{0};
+
+  // Only touched on the render thread.
+  Clock::time_point build_start_;
+  Clock::time_point raster_start_;
+  uint64_t frame_count_ = 0;
+  PhaseStats build_stats_;
+  PhaseStats raster_stats_;
+  PhaseStats present_stats_;
+  Clock::time_point first_present_;
+  Clock::time_point rate_start_;
+  uint64_t rate_frames_ = 0;
+
+  bool SetupEGL();
+
+  bool StartWarmupTimer();
+
+  void OnWarmupTimerFired();
+
+  bool ResizeFramebuffer(size_t width, size_t height);
+
+  void DestroyFramebuffer();
+
+  void LogSummary() const;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationContextMakeCurrent() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationContextClearCurrent() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationMakeResourceCurrent() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationPresent() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  uint32_t OnApplicationGetOnscreenFBO() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  uint32_t OnApplicationGetOnscreenFBOWithSize(size_t width,
+                                               size_t height) override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationVsync(intptr_t baton) override;
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(HeadlessDisplay);
+};
+
+}  // namespace flutter
@@ -0,0 +1,393 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef WL_EGL_PLATFORM
+#define WL_EGL_PLATFORM 1
+#endif
+
+#include "layer_compositor.h"
+
+#include <GLES2/gl2ext.h>
+
+namespace flutter {
+
+// Draws a texture over the whole viewport. The engine renders into its
+// backing stores with a bottom-left origin, just like the surfaces they are
+// copied to, so no flip is needed.
+static const char* kVertexShader = R"~(
+attribute vec2 position;
+varying vec2 coordinates;
+void main() {
+  coordinates = position * 0.5 + 0.5;
+  gl_Position = vec4(position, 0.0, 1.0);
+}
+)~";
+
+static const char* kFragmentShader = R"~(
+precision mediump float;
+uniform sampler2D source;
+varying vec2 coordinates;
+void main() {
+  gl_FragColor = texture2D(source, coordinates);
+}
+)~";
+
+static GLuint CompileShader(GLenum type, const char* source) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+
+  GLint compiled = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (compiled != GL_TRUE) {
+    FLWAY_ERROR << "Could not compile the layer copy shader." << std::endl;
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+static GLuint CreateCopyProgram() {
+  GLuint vertex_shader = CompileShader(GL_VERTEX_SHADER, kVertexShader);
+  GLuint fragment_shader = CompileShader(GL_FRAGMENT_SHADER, kFragmentShader);
+  if (vertex_shader == 0 || fragment_shader == 0) {
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertex_shader);
+  glAttachShader(program, fragment_shader);
+  glBindAttribLocation(program, 0, "position");
+  glLinkProgram(program);
+  glDeleteShader(vertex_shader);
+  glDeleteShader(fragment_shader);
+
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (linked != GL_TRUE) {
+    FLWAY_ERROR << "Could not link the layer copy program." << std::endl;
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+LayerCompositor::LayerCompositor(Delegate& delegate,
+                                 wl_compositor* compositor,
+                                 wl_subcompositor* subcompositor,
+                                 wl_surface* parent,
+                                 EGLDisplay egl_display,
+                                 EGLConfig egl_config,
+                                 EGLContext engine_context)
+    : delegate_(delegate),
+      compositor_(compositor),
+      subcompositor_(subcompositor),
+      parent_(parent),
+      egl_display_(egl_display),
+      egl_config_(egl_config),
+      engine_context_(engine_context) {
+  const EGLint attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+  copy_context_ =
+      eglCreateContext(egl_display_, egl_config_, engine_context_, attribs);
+  if (copy_context_ == EGL_NO_CONTEXT) {
+    FLWAY_ERROR << "Could not create the layer copy context." << std::endl;
+    return;
+  }
+
+  flutter_compositor_.struct_size = sizeof(FlutterCompositor);
+  flutter_compositor_.user_data = this;
+  flutter_compositor_.create_backing_store_callback =
+      [](const FlutterBackingStoreConfig* config,
+         FlutterBackingStore* backing_store_out, void* user_data) -> bool {
+    return reinterpret_cast<LayerCompositor*>(user_data)->CreateBackingStore(
+        config, backing_store_out);
+  };
+  flutter_compositor_.collect_backing_store_callback =
+      [](const FlutterBackingStore* backing_store, void* user_data) -> bool {
+    return reinterpret_cast<LayerCompositor*>(user_data)->CollectBackingStore(
+        backing_store);
+  };
+  flutter_compositor_.present_layers_callback =
+      [](const FlutterLayer** layers, size_t layers_count,
+         void* user_data) -> bool {
+    return reinterpret_cast<LayerCompositor*>(user_data)->PresentLayers(
+        layers, layers_count);
+  };
+}
+
+LayerCompositor::~LayerCompositor() {
+  for (const auto& layer_surface : layer_surfaces_) {
+    DestroyLayerSurface(layer_surface.get());
+  }
+  layer_surfaces_.clear();
+
+  if (copy_context_ != EGL_NO_CONTEXT) {
+    // The program goes with the context.
+    eglDestroyContext(egl_display_, copy_context_);
+    copy_context_ = EGL_NO_CONTEXT;
+  }
+}
+
+bool LayerCompositor::IsValid() const {
+  return copy_context_ != EGL_NO_CONTEXT;
+}
+
+const FlutterCompositor* LayerCompositor::GetFlutterCompositor() const {
+  return &flutter_compositor_;
+}
+
+bool LayerCompositor::CreateBackingStore(
+    const FlutterBackingStoreConfig* config,
+    FlutterBackingStore* backing_store_out) {
+  const GLsizei width = config->size.width;
+  const GLsizei height = config->size.height;
+
+  // The engine's context is current. Textures are shared with the copy
+  // context, framebuffers are not, which is fine as only the engine renders
+  // into them.
+  auto store = std::make_unique<BackingStore>();
+  glGenTextures(1, &store->texture);
+  glBindTexture(GL_TEXTURE_2D, store->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &store->framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, store->framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         store->texture, 0);
+  const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    FLWAY_ERROR << "Could not create a layer backing store: " << status
+                << std::endl;
+    glDeleteFramebuffers(1, &store->framebuffer);
+    glDeleteTextures(1, &store->texture);
+    return false;
+  }
+
+  backing_store_out->type = kFlutterBackingStoreTypeOpenGL;
+  backing_store_out->user_data = store.get();
+  backing_store_out->open_gl.type = kFlutterOpenGLTargetTypeFramebuffer;
+  backing_store_out->open_gl.framebuffer.target = GL_RGBA8_OES;
+  backing_store_out->open_gl.framebuffer.name = store->framebuffer;
+  backing_store_out->open_gl.framebuffer.user_data = nullptr;
+  // Freed in CollectBackingStore.
+  backing_store_out->open_gl.framebuffer.destruction_callback = [](void*) {};
+  store.release();
+  return true;
+}
+
+bool LayerCompositor::CollectBackingStore(
+    const FlutterBackingStore* backing_store) {
+  auto store = reinterpret_cast<BackingStore*>(backing_store->user_data);
+
+  // Anything still showing it keeps its buffer, but must be redrawn before
+  // it could be skipped again.
+  if (presented_base_ == store) {
+    presented_base_ = nullptr;
+  }
+  for (const auto& layer_surface : layer_surfaces_) {
+    if (layer_surface->presented == store) {
+      layer_surface->presented = nullptr;
+    }
+  }
+
+  glDeleteFramebuffers(1, &store->framebuffer);
+  glDeleteTextures(1, &store->texture);
+  delete store;
+  return true;
+}
+
+bool LayerCompositor::PresentLayers(const FlutterLayer** layers,
+                                    size_t layers_count) {
+  // Whatever the engine's context is bound to, it gets back at the end.
+  EGLSurface engine_surface = eglGetCurrentSurface(EGL_DRAW);
+  const FlutterLayer* base = nullptr;
+  size_t surface_count = 0;
+  bool result = true;
+
+  // The subsurfaces are committed first. In synchronized mode their state is
+  // only applied with the commit of the onscreen surface, at the very end.
+  for (size_t i = 0; i < layers_count; i++) {
+    const FlutterLayer* layer = layers[i];
+    if (layer->type != kFlutterLayerContentTypeBackingStore) {
+      if (!platform_views_logged_) {
+        platform_views_logged_ = true;
+        FLWAY_ERROR << "Platform views are not supported. Skipping them."
+                    << std::endl;
+      }
+      continue;
+    }
+
+    if (base == nullptr) {
+      base = layer;
+      continue;
+    }
+
+    const int width = layer->size.width;
+    const int height = layer->size.height;
+    auto store =
+        reinterpret_cast<const BackingStore*>(layer->backing_store->user_data);
+    LayerSurface* layer_surface =
+        GetLayerSurface(surface_count++, width, height);
+    if (layer_surface == nullptr) {
+      result = false;
+      continue;
+    }
+
+    const int32_t scale = delegate_.OnCompositorGetBufferScale();
+    wl_subsurface_set_position(layer_surface->subsurface,
+                               layer->offset.x / scale,
+                               layer->offset.y / scale);
+    wl_surface_set_buffer_scale(layer_surface->surface, scale);
+
+    if (layer_surface->presented == store &&
+        !layer->backing_store->did_update) {
+      continue;
+    }
+
+    if (eglMakeCurrent(egl_display_, layer_surface->egl_surface,
+                       layer_surface->egl_surface,
+                       copy_context_) != EGL_TRUE ||
+        !CopyTexture(store->texture, width, height) ||
+        eglSwapBuffers(egl_display_, layer_surface->egl_surface) != EGL_TRUE) {
+      FLWAY_ERROR << "Could not present a layer." << std::endl;
+      result = false;
+      continue;
+    }
+    layer_surface->presented = store;
+  }
+
+  // Layers gone since the last frame.
+  while (layer_surfaces_.size() > surface_count) {
+    DestroyLayerSurface(layer_surfaces_.back().get());
+    layer_surfaces_.pop_back();
+  }
+
+  bool swap = false;
+  if (base != nullptr) {
+    auto store =
+        reinterpret_cast<const BackingStore*>(base->backing_store->user_data);
+    swap = presented_base_ != store || base->backing_store->did_update;
+
+    const int width = base->size.width;
+    const int height = base->size.height;
+    EGLSurface surface = delegate_.OnCompositorGetBaseSurface(width, height);
+    if (eglMakeCurrent(egl_display_, surface, surface, copy_context_) !=
+        EGL_TRUE) {
+      FLWAY_ERROR << "Could not make the onscreen surface current."
+                  << std::endl;
+      return false;
+    }
+    if (swap) {
+      result &= CopyTexture(store->texture, width, height);
+      presented_base_ = store;
+    }
+  }
+
+  result &= delegate_.OnCompositorPresentBase(swap);
+
+  eglMakeCurrent(egl_display_, engine_surface, engine_surface,
+                 engine_context_);
+  return result;
+}
+
+LayerCompositor::LayerSurface* LayerCompositor::GetLayerSurface(size_t index,
+                                                                int width,
+                                                                int height) {
+  if (index < layer_surfaces_.size()) {
+    LayerSurface* layer_surface = layer_surfaces_[index].get();
+    if (layer_surface->width != width || layer_surface->height != height) {
+      wl_egl_window_resize(layer_surface->window, width, height, 0, 0);
+      layer_surface->width = width;
+      layer_surface->height = height;
+      layer_surface->presented = nullptr;
+    }
+    return layer_surface;
+  }
+
+  // Subsurfaces are stacked above their parent and the siblings created
+  // before them, which is the order the layers come in.
+  auto layer_surface = std::make_unique<LayerSurface>();
+  layer_surface->width = width;
+  layer_surface->height = height;
+  layer_surface->surface = wl_compositor_create_surface(compositor_);
+  layer_surface->subsurface = wl_subcompositor_get_subsurface(
+      subcompositor_, layer_surface->surface, parent_);
+
+  // Input goes to the onscreen surface underneath.
+  wl_region* input_region = wl_compositor_create_region(compositor_);
+  wl_surface_set_input_region(layer_surface->surface, input_region);
+  wl_region_destroy(input_region);
+
+  layer_surface->window =
+      wl_egl_window_create(layer_surface->surface, width, height);
+  if (layer_surface->window != nullptr) {
+    layer_surface->egl_surface = eglCreateWindowSurface(
+        egl_display_, egl_config_, layer_surface->window, nullptr);
+  }
+
+  if (layer_surface->egl_surface == EGL_NO_SURFACE ||
+      eglMakeCurrent(egl_display_, layer_surface->egl_surface,
+                     layer_surface->egl_surface,
+                     copy_context_) != EGL_TRUE) {
+    FLWAY_ERROR << "Could not create a layer surface." << std::endl;
+    DestroyLayerSurface(layer_surface.get());
+    return nullptr;
+  }
+
+  // Frames are paced by the onscreen surface. A subsurface swap must never
+  // wait for frame callbacks of its own.
+  eglSwapInterval(egl_display_, 0);
+
+  layer_surfaces_.push_back(std::move(layer_surface));
+  return layer_surfaces_.back().get();
+}
+
+void LayerCompositor::DestroyLayerSurface(LayerSurface* layer_surface) {
+  if (layer_surface->egl_surface != EGL_NO_SURFACE) {
+    eglDestroySurface(egl_display_, layer_surface->egl_surface);
+  }
+  if (layer_surface->window) {
+    wl_egl_window_destroy(layer_surface->window);
+  }
+  if (layer_surface->subsurface) {
+    wl_subsurface_destroy(layer_surface->subsurface);
+  }
+  if (layer_surface->surface) {
+    wl_surface_destroy(layer_surface->surface);
+  }
+}
+
+bool LayerCompositor::CopyTexture(GLuint texture, int width, int height) {
+  if (program_ == 0) {
+    program_ = CreateCopyProgram();
+    if (program_ == 0) {
+      return false;
+    }
+  }
+
+  static const GLfloat kQuad[] = {-1, -1, 1, -1, -1, 1, 1, 1};
+
+  glViewport(0, 0, width, height);
+  glDisable(GL_BLEND);
+  glUseProgram(program_);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glUniform1i(glGetUniformLocation(program_, "source"), 0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, kQuad);
+  glEnableVertexAttribArray(0);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  return glGetError() == GL_NO_ERROR;
+}
+
+}  // namespace flutter
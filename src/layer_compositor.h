@@ -0,0 +1,114 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <flutter_embedder.h>
+#include <wayland-client.h>
+#include <wayland-egl.h>
+
+#include <memory>
+#include <vector>
+
+#include "macros.h"
+
+namespace flutter {
+
+// Implements the engine's FlutterCompositor on top of Wayland subsurfaces.
+//
+// Every backing store is an offscreen texture. On present, the bottom layer
+// is copied to the onscreen surface and each layer above it to a subsurface of
+// its own, stacked in order, so the Wayland compositor blends the layers. A
+// layer the engine did not update since it was last presented is neither
+// copied nor committed again.
+//
+// The copies are made with a context of its own that shares the engine's
+// textures, so the GL state the engine's rasterizer tracks is never touched.
+// All callbacks are invoked on the render thread.
+class LayerCompositor {
+ public:
+  class Delegate {
+   public:
+    // Returns the onscreen surface, sized for a frame of |width| by |height|
+    // pixels.
+    virtual EGLSurface OnCompositorGetBaseSurface(size_t width,
+                                                  size_t height) = 0;
+
+    // Returns the buffer scale of the onscreen surface.
+    virtual int32_t OnCompositorGetBufferScale() = 0;
+
+    // Commits the onscreen surface, which also applies the state of the
+    // subsurfaces. Swaps it first if |swap|, with the surface current.
+    virtual bool OnCompositorPresentBase(bool swap) = 0;
+  };
+
+  // |engine_context| is current on the render thread whenever the engine
+  // calls the compositor, and current again once it returns.
+  LayerCompositor(Delegate& delegate,
+                  wl_compositor* compositor,
+                  wl_subcompositor* subcompositor,
+                  wl_surface* parent,
+                  EGLDisplay egl_display,
+                  EGLConfig egl_config,
+                  EGLContext engine_context);
+
+  ~LayerCompositor();
+
+  bool IsValid() const;
+
+  const FlutterCompositor* GetFlutterCompositor() const;
+
+ private:
+  struct BackingStore {
+    GLuint texture = 0;
+    GLuint framebuffer = 0;
+  };
+
+  struct LayerSurface {
+    wl_surface* surface = nullptr;
+    wl_subsurface* subsurface = nullptr;
+    wl_egl_window* window = nullptr;
+    EGLSurface egl_surface = EGL_NO_SURFACE;
+    int width = 0;
+    int height = 0;
+    const BackingStore* presented = nullptr;
+  };
+
+  Delegate& delegate_;
+  wl_compositor* compositor_;
+  wl_subcompositor* subcompositor_;
+  wl_surface* parent_;
+  EGLDisplay egl_display_;
+  EGLConfig egl_config_;
+  EGLContext engine_context_;
+  EGLContext copy_context_ = EGL_NO_CONTEXT;
+  GLuint program_ = 0;
+  FlutterCompositor flutter_compositor_ = {};
+  std::vector<std::unique_ptr<LayerSurface>> layer_surfaces_;
+  const BackingStore* presented_base_ = nullptr;
+  bool platform_views_logged_ = false;
+
+  bool CreateBackingStore(const FlutterBackingStoreConfig* config,
+                          FlutterBackingStore* backing_store_out);
+
+  bool CollectBackingStore(const FlutterBackingStore* backing_store);
+
+  bool PresentLayers(const FlutterLayer** layers, size_t layers_count);
+
+  // Returns the subsurface for the |index|th layer above the bottom one,
+  // created and sized as needed.
+  LayerSurface* GetLayerSurface(size_t index, int width, int height);
+
+  void DestroyLayerSurface(LayerSurface* layer_surface);
+
+  // Draws |texture| over the whole of the current surface. |copy_context_|
+  // must be current.
+  bool CopyTexture(GLuint texture, int width, int height);
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(LayerCompositor);
+};
+
+}  // namespace flutter
@@ -2,12 +2,19 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <string>
 #include <vector>
 
+#include "embedder_options.h"
+#include "epoll_reactor.h"
 #include "flutter_application.h"
+#include "headless_display.h"
 #include "utils.h"
 #include "wayland_display.h"
 #include "wayland_event_loop.h"
@@ -18,7 +25,8 @@ static void PrintUsage() {
   std::cerr << "Flutter Wayland Embedder" << std::endl << std::endl;
   std::cerr << "========================" << std::endl;
   std::cerr << "Usage: `" << GetExecutableName()
-            << " <asset_bundle_path> <flutter_flags>`" << std::endl
+            << " <asset_bundle_path> <embedder_flags> <flutter_flags>`"
+            << std::endl
             << std::endl;
   std::cerr << R"~(
 This utility runs an instance of a Flutter application and renders using
@@ -38,10 +46,118 @@ asset_bundle_path: The Flutter application code needs to be snapshotted using
                    Flutter engine. To see all supported flags, run
                    `flutter_tester --help` using the test binary included in the
                    Flutter tools.
-)~" << std::endl;
+)~" << GetEmbedderOptionsUsage() << std::endl;
+}
+
+// Returns a timerfd that expires every |seconds|, or -1.
+static int CreateIntervalTimer(int seconds) {
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd == -1) {
+    return -1;
+  }
+  itimerspec spec = {};
+  spec.it_value.tv_sec = seconds;
+  spec.it_interval.tv_sec = seconds;
+  if (timerfd_settime(timer_fd, 0, &spec, nullptr) == -1) {
+    close(timer_fd);
+    return -1;
+  }
+  return timer_fd;
+}
+
+// Runs the application on |display|, a WaylandDisplay or HeadlessDisplay,
+// until the display turns invalid.
+template <typename Display>
+static bool RunApplication(Display& display,
+                           EpollReactor& reactor,
+                           const std::string& asset_bundle_path,
+                           const std::vector<std::string>& args,
+                           const EmbedderOptions& options,
+                           sigset_t stats_signals) {
+  if (!display.IsValid()) {
+    FLWAY_ERROR << "Display was not valid." << std::endl;
+    return false;
+  }
+
+  FlutterApplication application(asset_bundle_path, args, display, reactor,
+                                 options.shader_cache_path);
+  if (!application.IsValid()) {
+    FLWAY_ERROR << "Flutter application was not valid." << std::endl;
+    return false;
+  }
+
+  EventLoop::SchedulingPolicy policy;
+  if (options.task_budget_us > 0) {
+    policy.task_budget = std::chrono::microseconds(options.task_budget_us);
+  }
+  if (options.min_tasks_per_slice > 0) {
+    policy.min_tasks_per_slice = options.min_tasks_per_slice;
+  }
+  application.event_loop_->SetSchedulingPolicy(policy);
+
+  //Add For Pointer Event Handling */
+  display.application = &application;
+
+  if (!display.SendInitialWindowSize()) {
+    FLWAY_ERROR << "Could not update Flutter application size." << std::endl;
+    return false;
+  }
+
+  // Dump event loop statistics on SIGUSR1 and, if asked to, periodically.
+  const int stats_signal_fd =
+      signalfd(-1, &stats_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (stats_signal_fd != -1) {
+    reactor.AddFd(stats_signal_fd, EPOLLIN, [&](uint32_t events) {
+      signalfd_siginfo info;
+      while (read(stats_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+      }
+      application.DumpEventLoopStats(std::cerr);
+      display.DumpStats(std::cerr);
+    });
+  }
+
+  const int stats_timer_fd = options.stats_interval_seconds > 0
+                                 ? CreateIntervalTimer(
+                                       options.stats_interval_seconds)
+                                 : -1;
+  if (stats_timer_fd != -1) {
+    reactor.AddFd(stats_timer_fd, EPOLLIN, [&](uint32_t events) {
+      uint64_t expirations = 0;
+      if (read(stats_timer_fd, &expirations, sizeof(expirations)) > 0) {
+        application.DumpEventLoopStats(std::cerr);
+        display.DumpStats(std::cerr);
+      }
+    });
+  }
+
+  // Block until the next engine task deadline, Wayland traffic or an explicit
+  // wake. A static screen costs no wakeups at all.
+  while (display.IsValid()) {
+    application.event_loop_->WaitForEvents();
+  }
+
+  for (int fd : {stats_signal_fd, stats_timer_fd}) {
+    if (fd != -1) {
+      reactor.RemoveFd(fd);
+      close(fd);
+    }
+  }
+
+  const auto counters = application.event_loop_->GetWakeupCounters();
+  FLWAY_LOG << "Event loop woke up " << counters.wakeups << " times, "
+            << counters.spurious_wakeups << " of them spuriously." << std::endl;
+
+  return true;
 }
 
 static bool Main(std::vector<std::string> args) {
+  EmbedderOptions options;
+  if (!ParseEmbedderOptions(&args, &options)) {
+    std::cerr << "   <Invalid Embedder Flags>   " << std::endl;
+    PrintUsage();
+    return false;
+  }
+
   if (args.size() == 0) {
     std::cerr << "   <Invalid Arguments>   " << std::endl;
     PrintUsage();
@@ -56,42 +172,64 @@ static bool Main(std::vector<std::string> args) {
     return false;
   }
 
-  const size_t kWidth = 800;
-  const size_t kHeight = 600;
-
-  for (const auto& arg : args) {
-    FLWAY_ERROR << "Arg: " << arg << std::endl;
+  // The headless display only renders through OpenGL into one framebuffer.
+  // Measuring it in place of the pipeline these ask for would be misleading.
+  if ((options.headless || options.warmup) &&
+      (options.software_rendering || options.subsurface_layers ||
+       options.opaque || options.adaptive_resolution)) {
+    std::cerr << "   <Option Not Supported Headless>   " << std::endl;
+    PrintUsage();
+    return false;
   }
 
-  WaylandDisplay display(kWidth, kHeight);
+  if (options.warmup) {
+    if (options.shader_cache_path.empty()) {
+      std::cerr << "   <Warmup Needs A Shader Cache>   " << std::endl;
+      PrintUsage();
+      return false;
+    }
+    // Unlike program binaries, SkSL does not depend on the driver it was
+    // produced with. Later launches compile it before their first frame.
+    args.push_back("--cache-sksl");
+  }
 
-  if (!display.IsValid()) {
-    FLWAY_ERROR << "Wayland display was not valid." << std::endl;
+  if (!options.shader_cache_path.empty() &&
+      !CreateDirectoryAtPath(options.shader_cache_path)) {
+    FLWAY_ERROR << "Could not create the shader cache directory."
+                << std::endl;
     return false;
   }
 
-  FlutterApplication application(asset_bundle_path, args, display);
-  if (!application.IsValid()) {
-    FLWAY_ERROR << "Flutter application was not valid." << std::endl;
-    return false;
+  const size_t kWidth = 800;
+  const size_t kHeight = 600;
+
+  for (const auto& arg : args) {
+    FLWAY_ERROR << "Arg: " << arg << std::endl;
   }
 
-  //Add For Pointer Event Handling */
-  display.application = &application;
+  // Block SIGUSR1 before any thread is started, so that every thread inherits
+  // the mask and the signal is only ever consumed through the signalfd below.
+  sigset_t stats_signals;
+  sigemptyset(&stats_signals);
+  sigaddset(&stats_signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &stats_signals, nullptr);
 
-  if (!application.SetWindowSize(kWidth, kHeight)) {
-    FLWAY_ERROR << "Could not update Flutter application size." << std::endl;
+  EpollReactor reactor;
+
+  if (!reactor.IsValid()) {
+    FLWAY_ERROR << "Could not create the platform reactor." << std::endl;
     return false;
   }
 
-  // display.Run();
-  // std::chrono::nanoseconds wait_duration = std::chrono::microseconds::max();
-  std::chrono::microseconds wait_duration = std::chrono::microseconds(1000);
-  while (display.IsValid()) {
-      application.event_loop_->WaitForEvents(wait_duration);
+  if (options.headless || options.warmup) {
+    HeadlessDisplay display(reactor, kWidth, kHeight, options);
+    return RunApplication(display, reactor, asset_bundle_path, args, options,
+                          stats_signals);
   }
 
-  return true;
+  WaylandDisplay display(reactor, kWidth, kHeight, options);
+  return RunApplication(display, reactor, asset_bundle_path, args, options,
+                        stats_signals);
 }
 
 }  // namespace flutter
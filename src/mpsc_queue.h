@@ -0,0 +1,80 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+#include "macros.h"
+
+namespace flutter {
+
+// An unbounded, lock-free, multi-producer single-consumer FIFO.
+//
+// Push() may be called concurrently from any number of threads and never
+// blocks. Pop() must only ever be called from one thread at a time. This is the
+// classic intrusive-stub design: producers serialize on a single atomic
+// exchange of |head_| and then link the previous node to their own.
+//
+// A producer that has exchanged |head_| but not yet linked its node makes
+// Pop() report an empty queue for items pushed after it. Callers that pair
+// Push() with a wakeup (as EventLoop does) never lose such items, since the
+// producer wakes the consumer only after Push() has returned.
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+  ~MpscQueue() {
+    T value;
+    while (Pop(&value)) {
+    }
+    if (tail_ != &stub_) {
+      delete tail_;
+    }
+  }
+
+  // Enqueues |value|. Safe to call from any thread.
+  void Push(T value) {
+    Node* node = new Node(std::move(value));
+    Node* previous = head_.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  // Dequeues the oldest value into |value|. Returns false if nothing is
+  // available. Must only be called from the consumer thread.
+  bool Pop(T* value) {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    *value = std::move(next->value);
+    tail_ = next;
+    if (tail != &stub_) {
+      delete tail;
+    }
+    return true;
+  }
+
+ private:
+  struct Node {
+    Node() = default;
+    explicit Node(T v) : value(std::move(v)) {}
+
+    std::atomic<Node*> next{nullptr};
+    T value{};
+  };
+
+  Node stub_;
+  // Producer side. Points at the most recently pushed node.
+  std::atomic<Node*> head_;
+  // Consumer side. Points at the node whose successor is the next value.
+  Node* tail_;
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+}  // namespace flutter
@@ -0,0 +1,171 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "presentation_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace flutter {
+
+constexpr size_t PresentationTracker::kWindow;
+
+const wp_presentation_listener PresentationTracker::kPresentationListener = {
+    .clock_id = [](void* data, struct wp_presentation* presentation,
+                   uint32_t clk_id) -> void {
+      reinterpret_cast<PresentationTracker*>(data)->clock_id_ =
+          static_cast<clockid_t>(clk_id);
+    },
+};
+
+const wp_presentation_feedback_listener
+    PresentationTracker::kFeedbackListener = {
+        .sync_output = [](void* data,
+                          struct wp_presentation_feedback* feedback,
+                          struct wl_output* output) -> void {},
+        .presented = [](void* data,
+                        struct wp_presentation_feedback* wp_feedback,
+                        uint32_t tv_sec_hi,
+                        uint32_t tv_sec_lo,
+                        uint32_t tv_nsec,
+                        uint32_t refresh,
+                        uint32_t seq_hi,
+                        uint32_t seq_lo,
+                        uint32_t flags) -> void {
+          auto feedback = reinterpret_cast<Feedback*>(data);
+          timespec time = {};
+          time.tv_sec = (static_cast<uint64_t>(tv_sec_hi) << 32) | tv_sec_lo;
+          time.tv_nsec = tv_nsec;
+          feedback->tracker->OnPresented(
+              feedback, feedback->tracker->ToSteadyTime(time),
+              std::chrono::nanoseconds(refresh),
+              (static_cast<uint64_t>(seq_hi) << 32) | seq_lo, flags);
+        },
+        .discarded = [](void* data,
+                        struct wp_presentation_feedback* wp_feedback) -> void {
+          auto feedback = reinterpret_cast<Feedback*>(data);
+          feedback->tracker->discarded_++;
+          feedback->tracker->Complete(feedback);
+        },
+};
+
+PresentationTracker::PresentationTracker(wp_presentation* presentation)
+    : presentation_(presentation) {
+  wp_presentation_add_listener(presentation_, &kPresentationListener, this);
+}
+
+PresentationTracker::~PresentationTracker() {
+  for (Feedback* feedback : pending_) {
+    wp_presentation_feedback_destroy(feedback->feedback);
+    delete feedback;
+  }
+  pending_.clear();
+
+  wp_presentation_destroy(presentation_);
+}
+
+void PresentationTracker::OnCommit(wl_surface* surface, TimePoint frame_start) {
+  auto feedback = new Feedback();
+  feedback->tracker = this;
+  feedback->frame_start = frame_start;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.insert(feedback);
+  }
+
+  // No event can arrive before the commit that follows.
+  feedback->feedback = wp_presentation_feedback(presentation_, surface);
+  wp_presentation_feedback_add_listener(feedback->feedback, &kFeedbackListener,
+                                        feedback);
+}
+
+void PresentationTracker::OnPresented(Feedback* feedback,
+                                      TimePoint presented,
+                                      std::chrono::nanoseconds refresh,
+                                      uint64_t sequence,
+                                      uint32_t flags) {
+  presented_++;
+
+  const auto latency = presented - feedback->frame_start;
+  latency_us_.Add(std::max<int64_t>(
+      0,
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count()));
+  window_[window_next_] = latency;
+  window_next_ = (window_next_ + 1) % kWindow;
+  window_count_ = std::min(window_count_ + 1, kWindow);
+
+  // Without vsync, the compositor does not count vblanks, and the refresh
+  // is only an estimate if it is reported at all.
+  const bool vsync = (flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC) != 0;
+  if (vsync && refresh.count() > 0) {
+    if (has_last_ && sequence > last_sequence_) {
+      const int64_t frames_apart = std::llround(
+          static_cast<double>((feedback->frame_start - last_frame_start_)
+                                  .count()) /
+          static_cast<double>(refresh.count()));
+      const int64_t vblanks_apart = sequence - last_sequence_;
+      if (frames_apart > 0 && vblanks_apart > frames_apart) {
+        missed_vblanks_ += vblanks_apart - frames_apart;
+      }
+    }
+    has_last_ = true;
+    last_sequence_ = sequence;
+    last_frame_start_ = feedback->frame_start;
+  } else {
+    has_last_ = false;
+  }
+
+  Complete(feedback);
+}
+
+void PresentationTracker::Complete(Feedback* feedback) {
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.erase(feedback);
+  }
+  wp_presentation_feedback_destroy(feedback->feedback);
+  delete feedback;
+}
+
+PresentationTracker::TimePoint PresentationTracker::ToSteadyTime(
+    const timespec& time) const {
+  // The steady clock is CLOCK_MONOTONIC, which compositors usually present
+  // on. Any other clock is mapped through the current offset between them.
+  timespec now = {};
+  clock_gettime(clock_id_, &now);
+  const auto steady_now = std::chrono::steady_clock::now();
+  const auto since_now = std::chrono::seconds(time.tv_sec - now.tv_sec) +
+                         std::chrono::nanoseconds(time.tv_nsec - now.tv_nsec);
+  return steady_now +
+         std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+             since_now);
+}
+
+void PresentationTracker::Dump(std::ostream& stream) const {
+  stream << "[presentation] frames: presented=" << presented_
+         << " discarded=" << discarded_
+         << " missed_vblanks=" << missed_vblanks_ << std::endl;
+
+  stream << "[presentation] ";
+  latency_us_.Dump(stream, "latency_us");
+
+  // Exact percentiles of the latest frames.
+  std::chrono::nanoseconds window[kWindow];
+  std::copy(window_, window_ + window_count_, window);
+  std::sort(window, window + window_count_);
+  stream << "[presentation] recent_latency_us: count=" << window_count_;
+  if (window_count_ > 0) {
+    auto percentile = [&](size_t percent) {
+      const size_t index = (window_count_ - 1) * percent / 100;
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+                 window[index])
+          .count();
+    };
+    stream << " p50=" << percentile(50) << " p90=" << percentile(90)
+           << " p99=" << percentile(99) << " max=" << percentile(100);
+  }
+  stream << std::endl;
+}
+
+}  // namespace flutter
@@ -0,0 +1,98 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <time.h>
+#include <wayland-client.h>
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <unordered_set>
+
+#include "event_loop_stats.h"
+#include "macros.h"
+#include "presentation-time-client-protocol.h"
+
+namespace flutter {
+
+// Follows every committed frame to the screen through wp_presentation
+// feedback.
+//
+// Each frame is tagged with the start of the vsync interval the engine built
+// it for. When the compositor reports it presented, the latency from there to
+// the presentation timestamp is recorded. So are vblanks missed: two frames
+// the engine started N refresh periods apart should be presented N vblanks
+// apart, and any more than that were missed.
+class PresentationTracker {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  // Takes ownership of |presentation|. Its events are dispatched on the
+  // platform thread.
+  explicit PresentationTracker(wp_presentation* presentation);
+
+  ~PresentationTracker();
+
+  // Requests feedback for the next commit of |surface|, for a frame started
+  // at |frame_start|. Safe to call from any thread, ahead of the commit.
+  void OnCommit(wl_surface* surface, TimePoint frame_start);
+
+  // Writes the latency distribution and frame counters to |stream|. Must be
+  // called on the platform thread.
+  void Dump(std::ostream& stream) const;
+
+ private:
+  struct Feedback {
+    PresentationTracker* tracker = nullptr;
+    // Needs the tag, as the request has the same name.
+    struct wp_presentation_feedback* feedback = nullptr;
+    TimePoint frame_start;
+  };
+
+  static const wp_presentation_listener kPresentationListener;
+  static const wp_presentation_feedback_listener kFeedbackListener;
+
+  // Latencies of this many of the latest frames make up the rolling
+  // distribution. Two seconds at 60 Hz.
+  static constexpr size_t kWindow = 120;
+
+  wp_presentation* presentation_;
+  // Clock of the presentation timestamps.
+  clockid_t clock_id_ = CLOCK_MONOTONIC;
+
+  // Feedback still waiting for an event. Created on the render thread,
+  // completed on the platform thread.
+  std::mutex pending_mutex_;
+  std::unordered_set<Feedback*> pending_;
+
+  // Only touched on the platform thread.
+  uint64_t presented_ = 0;
+  uint64_t discarded_ = 0;
+  uint64_t missed_vblanks_ = 0;
+  Histogram latency_us_;
+  std::chrono::nanoseconds window_[kWindow] = {};
+  size_t window_next_ = 0;
+  size_t window_count_ = 0;
+  bool has_last_ = false;
+  uint64_t last_sequence_ = 0;
+  TimePoint last_frame_start_;
+
+  void OnPresented(Feedback* feedback,
+                   TimePoint presented,
+                   std::chrono::nanoseconds refresh,
+                   uint64_t sequence,
+                   uint32_t flags);
+
+  void Complete(Feedback* feedback);
+
+  // Converts |time| on |clock_id_| to the steady clock.
+  TimePoint ToSteadyTime(const timespec& time) const;
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(PresentationTracker);
+};
+
+}  // namespace flutter
@@ -0,0 +1,122 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "shm_buffer_pool.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace flutter {
+
+const wl_buffer_listener ShmBufferPool::kBufferListener = {
+    .release = [](void* data, struct wl_buffer* buffer) -> void {
+      reinterpret_cast<Buffer*>(data)->busy.store(false,
+                                                  std::memory_order_release);
+    },
+};
+
+ShmBufferPool::ShmBufferPool(wl_shm* shm,
+                             int32_t width,
+                             int32_t height,
+                             size_t count,
+                             uint32_t format)
+    : width_(width), height_(height), stride_(width * 4) {
+  if (shm == nullptr || width <= 0 || height <= 0 || count == 0) {
+    FLWAY_ERROR << "Invalid shared memory pool parameters." << std::endl;
+    return;
+  }
+
+  const size_t buffer_size = static_cast<size_t>(stride_) * height_;
+  size_ = buffer_size * count;
+
+  // The file only needs to exist for as long as it takes to map it and hand
+  // it to the compositor.
+  const int fd = memfd_create("flutter-wayland-shm", MFD_CLOEXEC);
+  if (fd == -1) {
+    FLWAY_ERROR << "Could not create the shared memory file." << std::endl;
+    return;
+  }
+
+  if (ftruncate(fd, size_) == -1) {
+    FLWAY_ERROR << "Could not size the shared memory file." << std::endl;
+    close(fd);
+    return;
+  }
+
+  data_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data_ == MAP_FAILED) {
+    FLWAY_ERROR << "Could not map the shared memory file." << std::endl;
+    data_ = nullptr;
+    close(fd);
+    return;
+  }
+
+  pool_ = wl_shm_create_pool(shm, fd, size_);
+  close(fd);
+
+  if (pool_ == nullptr) {
+    FLWAY_ERROR << "Could not create the wl_shm pool." << std::endl;
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    auto buffer = std::make_unique<Buffer>();
+    buffer->pixels = static_cast<uint8_t*>(data_) + buffer_size * i;
+    buffer->buffer =
+        wl_shm_pool_create_buffer(pool_, buffer_size * i, width_, height_,
+                                  stride_, format);
+    if (buffer->buffer == nullptr) {
+      FLWAY_ERROR << "Could not create a wl_shm buffer." << std::endl;
+      return;
+    }
+    wl_buffer_add_listener(buffer->buffer, &kBufferListener, buffer.get());
+    buffers_.push_back(std::move(buffer));
+  }
+
+  valid_ = true;
+}
+
+ShmBufferPool::~ShmBufferPool() {
+  for (const auto& buffer : buffers_) {
+    wl_buffer_destroy(buffer->buffer);
+  }
+  buffers_.clear();
+
+  if (pool_) {
+    wl_shm_pool_destroy(pool_);
+    pool_ = nullptr;
+  }
+
+  if (data_) {
+    munmap(data_, size_);
+    data_ = nullptr;
+  }
+}
+
+bool ShmBufferPool::IsValid() const {
+  return valid_;
+}
+
+int32_t ShmBufferPool::GetWidth() const {
+  return width_;
+}
+
+int32_t ShmBufferPool::GetHeight() const {
+  return height_;
+}
+
+int32_t ShmBufferPool::GetStride() const {
+  return stride_;
+}
+
+ShmBufferPool::Buffer* ShmBufferPool::AcquireBuffer() {
+  for (const auto& buffer : buffers_) {
+    if (!buffer->busy.load(std::memory_order_acquire)) {
+      return buffer.get();
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace flutter
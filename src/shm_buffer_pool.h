@@ -0,0 +1,68 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <wayland-client.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "macros.h"
+
+namespace flutter {
+
+// A fixed set of equally sized 32-bit wl_buffers carved out of a single
+// memfd-backed wl_shm pool.
+class ShmBufferPool {
+ public:
+  struct Buffer {
+    wl_buffer* buffer = nullptr;
+    uint8_t* pixels = nullptr;
+    // Set while the compositor may read from the buffer. Cleared from
+    // whichever thread dispatches the wl_buffer.release event.
+    std::atomic<bool> busy{false};
+    // Serial of the frame the pixels hold. Zero for a buffer never written.
+    uint64_t frame = 0;
+  };
+
+  // |format| is one of the 32-bit wl_shm formats.
+  ShmBufferPool(wl_shm* shm,
+                int32_t width,
+                int32_t height,
+                size_t count,
+                uint32_t format);
+
+  ~ShmBufferPool();
+
+  bool IsValid() const;
+
+  int32_t GetWidth() const;
+
+  int32_t GetHeight() const;
+
+  int32_t GetStride() const;
+
+  // Returns a buffer the compositor is done with, or nullptr if all of them
+  // are still attached. The caller marks it busy before attaching it.
+  Buffer* AcquireBuffer();
+
+ private:
+  static const wl_buffer_listener kBufferListener;
+
+  bool valid_ = false;
+  const int32_t width_;
+  const int32_t height_;
+  const int32_t stride_;
+  size_t size_ = 0;
+  void* data_ = nullptr;
+  wl_shm_pool* pool_ = nullptr;
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(ShmBufferPool);
+};
+
+}  // namespace flutter
@@ -0,0 +1,316 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "texture_registrar.h"
+
+#include <GLES3/gl3.h>
+
+#include <cstring>
+#include <iterator>
+
+namespace flutter {
+
+// One buffer being written by the producer, one submitted and one being
+// uploaded.
+static constexpr size_t kPixelBufferCount = 3;
+
+// The texture the engine may still be sampling from, and the one uploaded
+// to next. The same goes for the unpack buffers.
+static constexpr size_t kTextureCount = 2;
+
+struct TextureRegistrar::Texture {
+  enum class State {
+    available,
+    writing,
+    submitted,
+    uploading,
+  };
+
+  size_t width = 0;
+  size_t height = 0;
+  // Guarded by the registrar's mutex, as are the states.
+  PixelBuffer buffers[kPixelBufferCount];
+  State states[kPixelBufferCount] = {};
+  // Only touched on the render thread.
+  GLuint textures[kTextureCount] = {};
+  GLuint unpack_buffers[kTextureCount] = {};
+  size_t next_texture = 0;
+  // Holds the latest uploaded frame. Zero until there is one.
+  GLuint current_texture = 0;
+};
+
+TextureRegistrar::TextureRegistrar(const FlutterEngine* engine)
+    : engine_(engine) {}
+
+// The GL objects of textures still registered die with the context.
+TextureRegistrar::~TextureRegistrar() = default;
+
+int64_t TextureRegistrar::RegisterTexture(size_t width, size_t height) {
+  if (width == 0 || height == 0) {
+    FLWAY_ERROR << "Invalid external texture dimensions." << std::endl;
+    return 0;
+  }
+
+  auto texture = std::make_shared<Texture>();
+  texture->width = width;
+  texture->height = height;
+  for (auto& buffer : texture->buffers) {
+    buffer.pixels.resize(width * height * 4);
+    buffer.width = width;
+    buffer.height = height;
+  }
+
+  int64_t texture_id = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    texture_id = ++last_texture_id_;
+    textures_[texture_id] = texture;
+  }
+
+  if (FlutterEngineRegisterExternalTexture(*engine_, texture_id) !=
+      kSuccess) {
+    FLWAY_ERROR << "Could not register an external texture." << std::endl;
+    std::lock_guard<std::mutex> lock(mutex_);
+    textures_.erase(texture_id);
+    return 0;
+  }
+
+  return texture_id;
+}
+
+bool TextureRegistrar::UnregisterTexture(int64_t texture_id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = textures_.find(texture_id);
+    if (found == textures_.end()) {
+      FLWAY_ERROR << "Unregistering an unknown external texture."
+                  << std::endl;
+      return false;
+    }
+    unregistered_textures_.push_back(std::move(found->second));
+    textures_.erase(found);
+  }
+
+  return FlutterEngineUnregisterExternalTexture(*engine_, texture_id) ==
+         kSuccess;
+}
+
+TextureRegistrar::PixelBuffer* TextureRegistrar::AcquireBuffer(
+    int64_t texture_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = textures_.find(texture_id);
+  if (found == textures_.end()) {
+    return nullptr;
+  }
+
+  Texture* texture = found->second.get();
+  for (size_t i = 0; i < kPixelBufferCount; i++) {
+    if (texture->states[i] == Texture::State::available) {
+      texture->states[i] = Texture::State::writing;
+      return &texture->buffers[i];
+    }
+  }
+  return nullptr;
+}
+
+bool TextureRegistrar::SubmitBuffer(int64_t texture_id, PixelBuffer* buffer) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = textures_.find(texture_id);
+    if (found == textures_.end()) {
+      return false;
+    }
+
+    Texture* texture = found->second.get();
+    const size_t index = buffer - texture->buffers;
+    if (index >= kPixelBufferCount ||
+        texture->states[index] != Texture::State::writing) {
+      FLWAY_ERROR << "Submitting a buffer not acquired for the texture."
+                  << std::endl;
+      return false;
+    }
+
+    for (auto& state : texture->states) {
+      if (state == Texture::State::submitted) {
+        state = Texture::State::available;
+      }
+    }
+    texture->states[index] = Texture::State::submitted;
+  }
+
+  return FlutterEngineMarkExternalTextureFrameAvailable(*engine_,
+                                                        texture_id) ==
+         kSuccess;
+}
+
+std::shared_ptr<TextureRegistrar::Texture> TextureRegistrar::GetTexture(
+    int64_t texture_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = textures_.find(texture_id);
+  if (found == textures_.end()) {
+    return nullptr;
+  }
+  return found->second;
+}
+
+void TextureRegistrar::DeleteUnregisteredTextures() {
+  std::vector<std::shared_ptr<Texture>> textures;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    textures.swap(unregistered_textures_);
+  }
+
+  // The engine may still hold an image of a texture it was handed, until it
+  // calls the destruction callback. Those are left for a later frame.
+  std::vector<std::shared_ptr<Texture>> in_use;
+  for (auto& texture : textures) {
+    if (texture.use_count() > 1) {
+      in_use.push_back(std::move(texture));
+      continue;
+    }
+    glDeleteTextures(kTextureCount, texture->textures);
+    if (unpack_buffers_supported_) {
+      glDeleteBuffers(kTextureCount, texture->unpack_buffers);
+    }
+  }
+
+  if (!in_use.empty()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unregistered_textures_.insert(unregistered_textures_.end(),
+                                  std::make_move_iterator(in_use.begin()),
+                                  std::make_move_iterator(in_use.end()));
+  }
+}
+
+bool TextureRegistrar::PopulateTexture(int64_t texture_id,
+                                       size_t width,
+                                       size_t height,
+                                       FlutterOpenGLTexture* texture_out) {
+  std::shared_ptr<Texture> texture = GetTexture(texture_id);
+  if (!texture) {
+    return false;
+  }
+
+  size_t index = kPixelBufferCount;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < kPixelBufferCount; i++) {
+      if (texture->states[i] == Texture::State::submitted) {
+        texture->states[i] = Texture::State::uploading;
+        index = i;
+        break;
+      }
+    }
+  }
+
+  // The buffer is left alone by producers while it is uploading.
+  if (index < kPixelBufferCount) {
+    Upload(texture.get(), &texture->buffers[index]);
+    std::lock_guard<std::mutex> lock(mutex_);
+    texture->states[index] = Texture::State::available;
+  }
+
+  if (texture->current_texture == 0) {
+    return false;
+  }
+
+  texture_out->target = GL_TEXTURE_2D;
+  texture_out->name = texture->current_texture;
+  texture_out->format = GL_RGBA8;
+  // Keeps the GL objects from being deleted until the engine lets go of the
+  // image, which may be well after the texture was unregistered.
+  texture_out->user_data = new std::shared_ptr<Texture>(std::move(texture));
+  texture_out->destruction_callback = [](void* user_data) {
+    delete reinterpret_cast<std::shared_ptr<Texture>*>(user_data);
+  };
+  return true;
+}
+
+void TextureRegistrar::Upload(Texture* texture, const PixelBuffer* buffer) {
+  if (!checked_unpack_buffers_) {
+    checked_unpack_buffers_ = true;
+    const char* version =
+        reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    // "OpenGL ES N.M", where anything from 3 on has unpack buffers.
+    unpack_buffers_supported_ = version != nullptr &&
+                                strncmp(version, "OpenGL ES ", 10) == 0 &&
+                                version[10] >= '3' && version[10] <= '9';
+    FLWAY_LOG << "External textures upload "
+              << (unpack_buffers_supported_ ? "through unpack buffers."
+                                            : "straight from memory.")
+              << std::endl;
+  }
+
+  const GLsizei width = texture->width;
+  const GLsizei height = texture->height;
+  const GLsizeiptr size = buffer->pixels.size();
+
+  // The engine's rasterizer tracks the GL state. Whatever is changed here is
+  // set back before returning.
+  GLint bound_texture = 0;
+  GLint unpack_alignment = 4;
+  GLint bound_unpack_buffer = 0;
+  GLint unpack_row_length = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound_texture);
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+  if (unpack_buffers_supported_) {
+    glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &bound_unpack_buffer);
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &unpack_row_length);
+  }
+
+  if (texture->textures[0] == 0) {
+    glGenTextures(kTextureCount, texture->textures);
+    for (GLuint name : texture->textures) {
+      glBindTexture(GL_TEXTURE_2D, name);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, nullptr);
+    }
+    if (unpack_buffers_supported_) {
+      glGenBuffers(kTextureCount, texture->unpack_buffers);
+    }
+  }
+
+  const size_t next = texture->next_texture;
+  texture->next_texture = (next + 1) % kTextureCount;
+
+  glBindTexture(GL_TEXTURE_2D, texture->textures[next]);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  const void* pixels = buffer->pixels.data();
+  if (unpack_buffers_supported_) {
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture->unpack_buffers[next]);
+    // Orphaning the storage keeps the map from waiting on a transfer from
+    // it that is still in flight.
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped != nullptr) {
+      memcpy(mapped, pixels, size);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      // An offset into the bound unpack buffer.
+      pixels = nullptr;
+    } else {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+  }
+
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA,
+                  GL_UNSIGNED_BYTE, pixels);
+  texture->current_texture = texture->textures[next];
+
+  glBindTexture(GL_TEXTURE_2D, bound_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+  if (unpack_buffers_supported_) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, bound_unpack_buffer);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, unpack_row_length);
+  }
+}
+
+}  // namespace flutter
@@ -0,0 +1,98 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <GLES2/gl2.h>
+#include <flutter_embedder.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "macros.h"
+
+namespace flutter {
+
+// Streams pixel buffers from producers into external textures the engine
+// composites, e.g. camera or decoded video frames.
+//
+// Every texture gets a fixed pool of pixel buffers when it is registered.
+// Producers fill one, on any thread, and submit it. The render thread uploads
+// the latest submitted buffer when the engine draws the texture, through a
+// pixel unpack buffer where OpenGL ES 3 has them, into one of two textures
+// used in turn. Nothing is allocated per frame.
+class TextureRegistrar {
+ public:
+  // A frame of tightly packed RGBA pixels, sized when the texture was
+  // registered.
+  struct PixelBuffer {
+    std::vector<uint8_t> pixels;
+    size_t width = 0;
+    size_t height = 0;
+  };
+
+  // |engine| must be set by the time a texture is registered.
+  explicit TextureRegistrar(const FlutterEngine* engine);
+
+  ~TextureRegistrar();
+
+  // Returns the id of a new |width| by |height| texture, or zero on failure.
+  // Safe to call from any thread.
+  int64_t RegisterTexture(size_t width, size_t height);
+
+  // Safe to call from any thread. Buffers acquired for the texture must not
+  // be touched afterwards.
+  bool UnregisterTexture(int64_t texture_id);
+
+  // Returns a buffer of |texture_id| to write the next frame to, or nullptr
+  // if all of them are waiting for the render thread. The frame can then be
+  // dropped. Safe to call from any thread.
+  PixelBuffer* AcquireBuffer(int64_t texture_id);
+
+  // Hands |buffer|, acquired from |texture_id| and filled, to the engine. A
+  // frame submitted earlier that was not drawn yet is dropped. Safe to call
+  // from any thread.
+  bool SubmitBuffer(int64_t texture_id, PixelBuffer* buffer);
+
+  // Uploads the latest frame of |texture_id| and describes the texture
+  // holding it in |texture_out|. Called by the engine on the render thread,
+  // with its context current.
+  bool PopulateTexture(int64_t texture_id,
+                       size_t width,
+                       size_t height,
+                       FlutterOpenGLTexture* texture_out);
+
+  // Frees the GL objects and pixel buffers of unregistered textures the
+  // engine no longer holds an image of. Called on the render thread with its
+  // context current, once a frame, whether or not any texture is left to
+  // populate.
+  void DeleteUnregisteredTextures();
+
+ private:
+  struct Texture;
+
+  const FlutterEngine* engine_;
+  std::mutex mutex_;
+  int64_t last_texture_id_ = 0;
+  std::map<int64_t, std::shared_ptr<Texture>> textures_;
+  // Unregistered textures whose GL objects the render thread has yet to
+  // delete, with the context current. Each image handed to the engine holds
+  // a reference to its texture until the engine destroys it.
+  std::vector<std::shared_ptr<Texture>> unregistered_textures_;
+  // Whether pixel unpack buffers are available. Found out on the render
+  // thread, with the first upload.
+  bool checked_unpack_buffers_ = false;
+  bool unpack_buffers_supported_ = false;
+
+  std::shared_ptr<Texture> GetTexture(int64_t texture_id);
+
+  void Upload(Texture* texture, const PixelBuffer* buffer);
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(TextureRegistrar);
+};
+
+}  // namespace flutter
@@ -4,8 +4,11 @@
 
 #include "utils.h"
 
+#include <errno.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <cstring>
 #include <sstream>
 
 namespace flutter {
@@ -46,6 +49,16 @@ bool FileExistsAtPath(const std::string& path) {
   return ::access(path.c_str(), R_OK) == 0;
 }
 
+bool CreateDirectoryAtPath(const std::string& path) {
+  if (::mkdir(path.c_str(), 0755) == 0) {
+    return true;
+  }
+
+  struct stat info = {};
+  return errno == EEXIST && ::stat(path.c_str(), &info) == 0 &&
+         S_ISDIR(info.st_mode);
+}
+
 bool FlutterAssetBundleIsValid(const std::string& bundle_path) {
   if (!FileExistsAtPath(bundle_path)) {
     FLWAY_ERROR << "Bundle directory does not exist." << std::endl;
@@ -60,4 +73,21 @@ bool FlutterAssetBundleIsValid(const std::string& bundle_path) {
   return true;
 }
 
+bool HasEGLExtension(const char* extensions, const char* name) {
+  if (extensions == nullptr) {
+    return false;
+  }
+
+  const size_t length = strlen(name);
+  for (const char* found = strstr(extensions, name); found != nullptr;
+       found = strstr(found + length, name)) {
+    // Make sure this is not just a prefix of a longer extension name.
+    if ((found == extensions || found[-1] == ' ') &&
+        (found[length] == ' ' || found[length] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace flutter
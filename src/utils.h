@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <string>
+
 #include "macros.h"
 
 namespace flutter {
@@ -14,6 +16,13 @@ std::string GetExecutableDirectory();
 
 bool FileExistsAtPath(const std::string& path);
 
+// Creates the directory at |path| unless it exists. Its parent must.
+bool CreateDirectoryAtPath(const std::string& path);
+
 bool FlutterAssetBundleIsValid(const std::string& bundle_path);
 
+// Whether |name| is one of the space separated |extensions|, as returned by
+// eglQueryString. |extensions| may be null.
+bool HasEGLExtension(const char* extensions, const char* name);
+
 }  // namespace flutter
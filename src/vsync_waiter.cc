@@ -0,0 +1,226 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "vsync_waiter.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace flutter {
+
+constexpr int VsyncWaiter::kFrameCallbackTimeoutPeriods;
+constexpr std::chrono::milliseconds VsyncWaiter::kHiddenTimeout;
+
+VsyncWaiter::VsyncWaiter(EpollReactor& reactor,
+                         Callback callback,
+                         VisibilityCallback visibility_callback)
+    : reactor_(reactor),
+      callback_(std::move(callback)),
+      visibility_callback_(std::move(visibility_callback)) {
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ == -1) {
+    FLWAY_ERROR << "Could not create the vsync timer: " << errno << std::endl;
+    return;
+  }
+
+  if (!reactor_.AddFd(timer_fd_, EPOLLIN,
+                      [this](uint32_t events) { OnTimerFired(); })) {
+    close(timer_fd_);
+    timer_fd_ = -1;
+  }
+}
+
+VsyncWaiter::~VsyncWaiter() {
+  if (timer_fd_ != -1) {
+    reactor_.RemoveFd(timer_fd_);
+    close(timer_fd_);
+  }
+}
+
+bool VsyncWaiter::IsValid() const {
+  return timer_fd_ != -1;
+}
+
+void VsyncWaiter::AwaitVsync(intptr_t baton) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_baton_ != 0) {
+    FLWAY_ERROR << "Engine requested vsync twice in a row." << std::endl;
+  }
+  pending_baton_ = baton;
+
+  const auto now = TimePoint::clock::now();
+  if (hidden_) {
+    // Only the frame callback that shows the surface again answers this.
+    return;
+  }
+  if (frame_callback_outstanding_) {
+    // The frame callback answers this. The timer only guards against a
+    // compositor that never sends it.
+    ArmTimerLocked(NextVsyncLocked(now) +
+                   period_ * kFrameCallbackTimeoutPeriods);
+  } else {
+    ArmTimerLocked(NextVsyncLocked(now));
+  }
+}
+
+void VsyncWaiter::OnFrameCallbackRequested() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!frame_callback_outstanding_) {
+    frame_callback_outstanding_ = true;
+    frame_callback_requested_ = TimePoint::clock::now();
+  }
+}
+
+void VsyncWaiter::OnFrameCallbackDone(uint32_t time_ms) {
+  const auto now = TimePoint::clock::now();
+  TimePoint vsync;
+  bool shown = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame_callback_outstanding_ = false;
+    vsync = FrameCallbackTimeLocked(time_ms, now);
+    last_vsync_ = vsync;
+    shown = hidden_;
+    hidden_ = false;
+  }
+  if (shown && visibility_callback_) {
+    visibility_callback_(true);
+  }
+  Fire(vsync);
+}
+
+void VsyncWaiter::SetRefreshPeriod(std::chrono::nanoseconds period) {
+  if (period.count() <= 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  period_ = period;
+}
+
+std::chrono::nanoseconds VsyncWaiter::GetRefreshPeriod() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return period_;
+}
+
+VsyncWaiter::TimePoint VsyncWaiter::FrameCallbackTimeLocked(
+    uint32_t time_ms,
+    const TimePoint& now) const {
+  // The protocol leaves the base of the timestamp undefined, but compositors
+  // stamp the repaint on CLOCK_MONOTONIC, the steady clock, in milliseconds
+  // that wrap around. Any timestamp more than a few refresh periods before
+  // now, or after it, is on some other clock and |now| is all there is.
+  const auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          now.time_since_epoch())
+                          .count();
+  const auto age =
+      std::chrono::milliseconds(static_cast<uint32_t>(now_ms) - time_ms);
+  if (age > period_ * kFrameCallbackTimeoutPeriods) {
+    return now;
+  }
+  return now - age;
+}
+
+VsyncWaiter::TimePoint VsyncWaiter::NextVsyncLocked(
+    const TimePoint& now) const {
+  if (last_vsync_ == TimePoint() || last_vsync_ >= now) {
+    return std::max(now, last_vsync_);
+  }
+  const auto elapsed_periods = (now - last_vsync_ + period_ -
+                                std::chrono::nanoseconds(1)) / period_;
+  return last_vsync_ + period_ * elapsed_periods;
+}
+
+VsyncWaiter::TimePoint VsyncWaiter::LastVsyncLocked(
+    const TimePoint& now) const {
+  if (last_vsync_ == TimePoint() || last_vsync_ >= now) {
+    return now;
+  }
+  return last_vsync_ + period_ * ((now - last_vsync_) / period_);
+}
+
+void VsyncWaiter::ArmTimerLocked(const TimePoint& time) {
+  if (timer_fd_ == -1) {
+    return;
+  }
+
+  itimerspec spec = {};
+  if (time == TimePoint::max()) {
+    timerfd_settime(timer_fd_, 0, &spec, nullptr);
+    return;
+  }
+
+  const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         time.time_since_epoch())
+                         .count();
+  spec.it_value.tv_sec = nanos / 1000000000;
+  spec.it_value.tv_nsec = nanos % 1000000000;
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    spec.it_value.tv_nsec = 1;
+  }
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+    FLWAY_ERROR << "Could not arm the vsync timer: " << errno << std::endl;
+  }
+}
+
+void VsyncWaiter::OnTimerFired() {
+  uint64_t expirations = 0;
+  if (read(timer_fd_, &expirations, sizeof(expirations)) == -1) {
+    return;
+  }
+
+  TimePoint frame_start;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = TimePoint::clock::now();
+    if (frame_callback_outstanding_ &&
+        now - frame_callback_requested_ >= kHiddenTimeout) {
+      hidden_ = true;
+    } else {
+      frame_start = LastVsyncLocked(now);
+      last_vsync_ = frame_start;
+    }
+  }
+
+  if (frame_start == TimePoint()) {
+    // The pending baton stays unanswered until the surface is shown again.
+    if (visibility_callback_) {
+      visibility_callback_(false);
+    }
+    return;
+  }
+
+  Fire(frame_start);
+
+  // Keep watching a frame callback that is still outstanding, whether or not
+  // the engine asks for another vsync in the meantime.
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (frame_callback_outstanding_ && pending_baton_ == 0) {
+    ArmTimerLocked(frame_callback_requested_ + kHiddenTimeout);
+  }
+}
+
+void VsyncWaiter::Fire(const TimePoint& frame_start) {
+  intptr_t baton = 0;
+  std::chrono::nanoseconds period;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    baton = pending_baton_;
+    pending_baton_ = 0;
+    period = period_;
+    if (baton != 0) {
+      // Nothing left to wait for.
+      ArmTimerLocked(TimePoint::max());
+    }
+  }
+
+  if (baton == 0) {
+    return;
+  }
+
+  callback_(baton, frame_start, frame_start + period);
+}
+
+}  // namespace flutter
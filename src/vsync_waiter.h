@@ -0,0 +1,117 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+#include "epoll_reactor.h"
+#include "macros.h"
+
+namespace flutter {
+
+// Answers engine vsync requests in step with the compositor's repaint cycle.
+//
+// The compositor's wl_surface.frame callbacks are the primary source of vsync.
+// When no frame callback is outstanding, for example because nothing has been
+// committed lately, the waiter extrapolates the next vblank from the last one
+// and the output refresh period, and fires a timerfd at that phase instead.
+//
+// A frame callback that stays outstanding for much longer than a few refresh
+// periods means the compositor is not showing the surface. The waiter then
+// reports the surface hidden and holds on to the engine's baton until the
+// frame callback finally arrives, so nothing is drawn in the meantime.
+class VsyncWaiter {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  // Invoked on the reactor thread with the baton to answer and the interval
+  // the engine should produce the frame in.
+  using Callback = std::function<
+      void(intptr_t baton, TimePoint frame_start, TimePoint frame_target)>;
+
+  // Invoked on the reactor thread whenever the surface is found to be hidden
+  // or shown again.
+  using VisibilityCallback = std::function<void(bool visible)>;
+
+  VsyncWaiter(EpollReactor& reactor,
+              Callback callback,
+              VisibilityCallback visibility_callback = nullptr);
+
+  ~VsyncWaiter();
+
+  bool IsValid() const;
+
+  // Schedules |baton| to be answered at the next vsync. Safe to call from any
+  // thread.
+  void AwaitVsync(intptr_t baton);
+
+  // Records that a frame callback was requested for the upcoming commit. Safe
+  // to call from any thread.
+  void OnFrameCallbackRequested();
+
+  // Records that the compositor signalled a frame callback, with the
+  // millisecond timestamp it sent along. Must be called on the reactor
+  // thread.
+  void OnFrameCallbackDone(uint32_t time_ms);
+
+  // Updates the refresh period of the output the surface is shown on. Safe to
+  // call from any thread.
+  void SetRefreshPeriod(std::chrono::nanoseconds period);
+
+  std::chrono::nanoseconds GetRefreshPeriod() const;
+
+ private:
+  // How many refresh periods to wait for an outstanding frame callback before
+  // falling back to the timer.
+  static constexpr int kFrameCallbackTimeoutPeriods = 4;
+
+  // How long a frame callback may stay outstanding before the surface is
+  // considered hidden.
+  static constexpr std::chrono::milliseconds kHiddenTimeout{500};
+
+  EpollReactor& reactor_;
+  Callback callback_;
+  VisibilityCallback visibility_callback_;
+  int timer_fd_ = -1;
+
+  mutable std::mutex mutex_;
+  intptr_t pending_baton_ = 0;
+  bool frame_callback_outstanding_ = false;
+  // When the oldest frame callback still outstanding was requested.
+  TimePoint frame_callback_requested_;
+  bool hidden_ = false;
+  TimePoint last_vsync_;
+  std::chrono::nanoseconds period_ = std::chrono::nanoseconds(16666667);
+
+  // Returns when the frame callback stamped |time_ms| fired, received at
+  // |now|. |mutex_| must be held.
+  TimePoint FrameCallbackTimeLocked(uint32_t time_ms,
+                                    const TimePoint& now) const;
+
+  // Returns the first vblank at or after |now| extrapolated from the last
+  // one. |mutex_| must be held.
+  TimePoint NextVsyncLocked(const TimePoint& now) const;
+
+  // Returns the last vblank at or before |now| extrapolated from the last
+  // one. |mutex_| must be held.
+  TimePoint LastVsyncLocked(const TimePoint& now) const;
+
+  // Arms the timer for |time|, or disarms it for TimePoint::max(). |mutex_|
+  // must be held.
+  void ArmTimerLocked(const TimePoint& time);
+
+  void OnTimerFired();
+
+  // Answers the pending baton, if any, for a vsync at |frame_start|.
+  void Fire(const TimePoint& frame_start);
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(VsyncWaiter);
+};
+
+}  // namespace flutter
@@ -0,0 +1,76 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "warmup_script.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace flutter {
+
+WarmupScript::WarmupScript() = default;
+
+bool WarmupScript::Load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    FLWAY_ERROR << "Could not open the warmup script " << path << std::endl;
+    return false;
+  }
+
+  std::string line;
+  for (size_t line_number = 1; std::getline(file, line); line_number++) {
+    std::istringstream stream(line);
+    std::string first;
+    if (!(stream >> first) || first[0] == '#') {
+      continue;
+    }
+
+    Event event;
+    std::string phase;
+    std::string rest;
+    std::istringstream frame_stream(first);
+    if (!(frame_stream >> event.frame) || !(stream >> phase) ||
+        !(stream >> event.x >> event.y) || (stream >> rest)) {
+      FLWAY_ERROR << "Malformed line " << line_number
+                  << " in the warmup script." << std::endl;
+      return false;
+    }
+
+    if (phase == "down") {
+      event.phase = EventPhase::down;
+    } else if (phase == "move") {
+      event.phase = EventPhase::move;
+    } else if (phase == "up") {
+      event.phase = EventPhase::up;
+    } else {
+      FLWAY_ERROR << "Unknown event \"" << phase << "\" on line "
+                  << line_number << " of the warmup script." << std::endl;
+      return false;
+    }
+
+    if (!events_.empty() && event.frame < events_.back().frame) {
+      FLWAY_ERROR << "Line " << line_number
+                  << " of the warmup script goes back in time." << std::endl;
+      return false;
+    }
+
+    events_.push_back(event);
+  }
+
+  return true;
+}
+
+uint64_t WarmupScript::GetLastFrame() const {
+  return events_.empty() ? 0 : events_.back().frame;
+}
+
+void WarmupScript::Replay(uint64_t frame, FlutterApplication& application) {
+  for (; next_event_ < events_.size() && events_[next_event_].frame <= frame;
+       next_event_++) {
+    const Event& event = events_[next_event_];
+    application.SendTouchEvent(event.phase, event.x, event.y);
+  }
+}
+
+}  // namespace flutter
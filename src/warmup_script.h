@@ -0,0 +1,49 @@
+// Copyright 2018 The Flutter Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "flutter_application.h"
+#include "macros.h"
+
+namespace flutter {
+
+// Touch events replayed during a shader warmup run, each at a given frame.
+//
+// The script has one event per line, "<frame> <down|move|up> <x> <y>", with
+// frames counted in refresh periods from the start and in increasing order.
+// Blank lines and lines starting with '#' are ignored.
+class WarmupScript {
+ public:
+  WarmupScript();
+
+  // Returns false, after logging why, if |path| cannot be read or parsed.
+  bool Load(const std::string& path);
+
+  // Returns the frame of the last event, or zero for an empty script.
+  uint64_t GetLastFrame() const;
+
+  // Sends the events due by |frame| that were not sent yet to |application|.
+  // Must be called on the platform thread.
+  void Replay(uint64_t frame, FlutterApplication& application);
+
+ private:
+  struct Event {
+    uint64_t frame = 0;
+    EventPhase phase = EventPhase::cancel;
+    int x = 0;
+    int y = 0;
+  };
+
+  std::vector<Event> events_;
+  size_t next_event_ = 0;
+
+  FLWAY_DISALLOW_COPY_AND_ASSIGN(WarmupScript);
+};
+
+}  // namespace flutter
@@ -11,7 +11,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
 
 namespace flutter {
 
@@ -44,7 +50,7 @@ const wl_shell_surface_listener WaylandDisplay::kShellSurfaceListener = {
                     uint32_t edges,
                     int32_t width,
                     int32_t height) -> void {
-      FLWAY_ERROR << "Unhandled resize." << std::endl;
+      DISPLAY->OnConfigure(width, height);
     },
 
     .popup_done = [](void* data,
@@ -103,8 +109,10 @@ const wl_pointer_listener WaylandDisplay::kPointerListener = {
 
       //FLWAY_LOG << "s_x=" << surface_x << ",s_y=" << surface_y << std::endl;
 
-      display->mouse_x_ = wl_fixed_to_double(surface_x);
-      display->mouse_y_ = wl_fixed_to_double(surface_y);
+      // Surface coordinates are logical. The engine wants physical pixels.
+      const double scale = display->pixel_ratio_;
+      display->mouse_x_ = wl_fixed_to_double(surface_x) * scale;
+      display->mouse_y_ = wl_fixed_to_double(surface_y) * scale;
 
       //FLWAY_LOG << "m_x=" << display->mouse_x_ << ",m_y=" \
                             << display->mouse_y_ << std::endl;
@@ -173,8 +181,8 @@ const wl_touch_listener WaylandDisplay::kTouchListener = {
         return;
       }
 
-      display->touch_x_ = wl_fixed_to_double(x);
-      display->touch_y_ = wl_fixed_to_double(y);
+      display->touch_x_ = wl_fixed_to_double(x) * display->pixel_ratio_;
+      display->touch_y_ = wl_fixed_to_double(y) * display->pixel_ratio_;
       //FLWAY_LOG << "t_x=" << display->touch_x_ << ",t_y=" << display->touch_y_ << std::endl;
       //FLWAY_LOG << "phase = down, id=" << id << std::endl;
 
@@ -223,8 +231,8 @@ const wl_touch_listener WaylandDisplay::kTouchListener = {
         return;
       }
 
-      display->touch_x_ = wl_fixed_to_double(x);
-      display->touch_y_ = wl_fixed_to_double(y);
+      display->touch_x_ = wl_fixed_to_double(x) * display->pixel_ratio_;
+      display->touch_y_ = wl_fixed_to_double(y) * display->pixel_ratio_;
 
       //FLWAY_LOG << "t_x=" << display->touch_x_ << ",t_y=" << display->touch_y_ << std::endl;
       //FLWAY_LOG << "phase = move, id=" << id << std::endl;
@@ -342,13 +350,113 @@ const wl_seat_listener WaylandDisplay::kSeatListener = {
 };
 // Add For Pointer Event Handling End
 
-WaylandDisplay::WaylandDisplay(size_t width, size_t height)
-    : screen_width_(width), screen_height_(height) {
+#define OUTPUT reinterpret_cast<WaylandDisplay::Output*>(data)
+
+const wl_output_listener WaylandDisplay::kOutputListener = {
+    .geometry = [](void* data,
+                   struct wl_output* wl_output,
+                   int32_t x,
+                   int32_t y,
+                   int32_t physical_width,
+                   int32_t physical_height,
+                   int32_t subpixel,
+                   const char* make,
+                   const char* model,
+                   int32_t transform) -> void {
+      OUTPUT->x = x;
+      OUTPUT->y = y;
+      OUTPUT->physical_width = physical_width;
+      OUTPUT->physical_height = physical_height;
+      OUTPUT->transform = transform;
+    },
+
+    .mode = [](void* data,
+               struct wl_output* wl_output,
+               uint32_t flags,
+               int32_t width,
+               int32_t height,
+               int32_t refresh) -> void {
+      if (!(flags & WL_OUTPUT_MODE_CURRENT)) {
+        return;
+      }
+      OUTPUT->width = width;
+      OUTPUT->height = height;
+      OUTPUT->refresh = refresh;
+    },
+
+    // Sent after each batch of the other events.
+    .done = [](void* data, struct wl_output* wl_output) -> void {
+      OUTPUT->display->OnOutputsChanged();
+    },
+
+    .scale = [](void* data, struct wl_output* wl_output, int32_t factor)
+        -> void { OUTPUT->scale = std::max(factor, 1); },
+};
+
+const wl_surface_listener WaylandDisplay::kSurfaceListener = {
+    .enter = [](void* data,
+                struct wl_surface* wl_surface,
+                struct wl_output* wl_output) -> void {
+      DISPLAY->OnSurfaceOutputChanged(wl_output, true);
+    },
+
+    .leave = [](void* data,
+                struct wl_surface* wl_surface,
+                struct wl_output* wl_output) -> void {
+      DISPLAY->OnSurfaceOutputChanged(wl_output, false);
+    },
+};
+
+const wl_callback_listener WaylandDisplay::kFrameListener = {
+    .done = [](void* data, struct wl_callback* callback, uint32_t time) -> void {
+      wl_callback_destroy(callback);
+      DISPLAY->OnFrameCallbackDone(time);
+    },
+};
+
+WaylandDisplay::WaylandDisplay(EpollReactor& reactor,
+                               size_t width,
+                               size_t height,
+                               const EmbedderOptions& options)
+    : screen_width_(width),
+      screen_height_(height),
+      window_width_(width),
+      window_height_(height),
+      sent_buffer_width_(width),
+      sent_buffer_height_(height),
+      sent_surface_width_(width),
+      sent_surface_height_(height),
+      software_rendering_(options.software_rendering),
+      swap_interval_(options.swap_interval),
+      opaque_(options.opaque),
+      subsurface_layers_(options.subsurface_layers) {
+  if (options.adaptive_resolution) {
+    adaptive_resolution_ = std::make_unique<AdaptiveResolution>();
+  }
+
   if (screen_width_ == 0 || screen_height_ == 0) {
     FLWAY_ERROR << "Invalid screen dimensions." << std::endl;
     return;
   }
 
+  vsync_waiter_ = std::make_unique<VsyncWaiter>(
+      reactor, [this](intptr_t baton, VsyncWaiter::TimePoint frame_start,
+                      VsyncWaiter::TimePoint frame_target) {
+        if (application == nullptr) {
+          FLWAY_ERROR << "Not exist an application to send vsync." << std::endl;
+          return;
+        }
+        vsync_start_.store(frame_start.time_since_epoch().count(),
+                           std::memory_order_relaxed);
+        application->OnVsync(baton, frame_start, frame_target);
+      },
+      [this](bool visible) { OnVisibilityChanged(visible); });
+
+  if (!vsync_waiter_->IsValid()) {
+    FLWAY_ERROR << "Could not create the vsync waiter." << std::endl;
+    return;
+  }
+
   display_ = wl_display_connect(nullptr);
 
   if (!display_) {
@@ -366,7 +474,17 @@ WaylandDisplay::WaylandDisplay(size_t width, size_t height)
 
   wl_display_roundtrip(display_);
 
-  if (!SetupEGL()) {
+  if (!SetupSurface()) {
+    FLWAY_ERROR << "Could not setup the surface." << std::endl;
+    return;
+  }
+
+  if (software_rendering_) {
+    if (!SetupSoftwareRendering()) {
+      FLWAY_ERROR << "Could not setup software rendering." << std::endl;
+      return;
+    }
+  } else if (!SetupEGL()) {
     FLWAY_ERROR << "Could not setup EGL." << std::endl;
     return;
   }
@@ -398,6 +516,44 @@ WaylandDisplay::~WaylandDisplay() {
     shell_ = nullptr;
   }
 
+  for (const auto& output : outputs_) {
+    wl_output_destroy(output->output);
+  }
+  outputs_.clear();
+
+  // The buffers must be gone before the surface they may be attached to.
+  shm_pool_.reset();
+
+  if (viewport_) {
+    wp_viewport_destroy(viewport_);
+    viewport_ = nullptr;
+  }
+
+  presentation_tracker_.reset();
+
+  if (viewporter_) {
+    wp_viewporter_destroy(viewporter_);
+    viewporter_ = nullptr;
+  }
+
+  // The layer surfaces are children of the onscreen one.
+  layer_compositor_.reset();
+
+  if (subcompositor_) {
+    wl_subcompositor_destroy(subcompositor_);
+    subcompositor_ = nullptr;
+  }
+
+  if (egl_resource_context_ != EGL_NO_CONTEXT) {
+    eglDestroyContext(egl_display_, egl_resource_context_);
+    egl_resource_context_ = EGL_NO_CONTEXT;
+  }
+
+  if (egl_resource_surface_ != EGL_NO_SURFACE) {
+    eglDestroySurface(egl_display_, egl_resource_surface_);
+    egl_resource_surface_ = EGL_NO_SURFACE;
+  }
+
   if (egl_surface_) {
     eglDestroySurface(egl_display_, egl_surface_);
     egl_surface_ = nullptr;
@@ -435,6 +591,12 @@ WaylandDisplay::~WaylandDisplay() {
   }
 }
 
+void WaylandDisplay::DumpStats(std::ostream& stream) const {
+  if (presentation_tracker_) {
+    presentation_tracker_->Dump(stream);
+  }
+}
+
 bool WaylandDisplay::IsValid() const {
   return valid_;
 }
@@ -500,9 +662,10 @@ static void LogLastEGLError() {
   FLWAY_ERROR << "Unknown EGL Error" << std::endl;
 }
 
-bool WaylandDisplay::SetupEGL() {
+bool WaylandDisplay::SetupSurface() {
   if (!compositor_ || !shell_) {
-    FLWAY_ERROR << "EGL setup needs missing compositor and shell connection."
+    FLWAY_ERROR << "Surface setup needs missing compositor and shell "
+                   "connection."
                 << std::endl;
     return false;
   }
@@ -514,6 +677,23 @@ bool WaylandDisplay::SetupEGL() {
     return false;
   }
 
+  wl_surface_add_listener(surface_, &kSurfaceListener, this);
+
+  if (opaque_) {
+    SetOpaqueRegion(window_width_, window_height_);
+  }
+
+  if (adaptive_resolution_) {
+    if (viewporter_ && !software_rendering_) {
+      viewport_ = wp_viewporter_get_viewport(viewporter_, surface_);
+    } else {
+      FLWAY_ERROR << "Adaptive resolution needs EGL and a wp_viewporter. "
+                     "Rendering at native resolution."
+                  << std::endl;
+      adaptive_resolution_.reset();
+    }
+  }
+
   shell_surface_ = wl_shell_get_shell_surface(shell_, surface_);
 
   if (!shell_surface_) {
@@ -527,6 +707,33 @@ bool WaylandDisplay::SetupEGL() {
 
   wl_shell_surface_set_toplevel(shell_surface_);
 
+  // Add For Drawing Cursor
+  cursor_surface_ = wl_compositor_create_surface(compositor_);
+
+  return true;
+}
+
+void WaylandDisplay::LogEGLConfig(EGLConfig config) const {
+  auto attrib = [&](EGLint name) {
+    EGLint value = 0;
+    eglGetConfigAttrib(egl_display_, config, name, &value);
+    return value;
+  };
+
+  FLWAY_LOG << "EGL config " << attrib(EGL_CONFIG_ID) << ": R"
+            << attrib(EGL_RED_SIZE) << "G" << attrib(EGL_GREEN_SIZE) << "B"
+            << attrib(EGL_BLUE_SIZE) << "A" << attrib(EGL_ALPHA_SIZE)
+            << ", depth " << attrib(EGL_DEPTH_SIZE) << ", stencil "
+            << attrib(EGL_STENCIL_SIZE) << std::endl;
+
+  if (opaque_ && attrib(EGL_ALPHA_SIZE) != 0) {
+    FLWAY_ERROR << "No config without alpha. The opaque region still saves "
+                   "the compositor from blending."
+                << std::endl;
+  }
+}
+
+bool WaylandDisplay::SetupEGL() {
   window_ = wl_egl_window_create(surface_, screen_width_, screen_height_);
 
   if (!window_) {
@@ -564,7 +771,7 @@ bool WaylandDisplay::SetupEGL() {
       EGL_RED_SIZE,        8,
       EGL_GREEN_SIZE,      8,
       EGL_BLUE_SIZE,       8,
-      EGL_ALPHA_SIZE,      8,
+      EGL_ALPHA_SIZE,      opaque_ ? 0 : 8,
       EGL_DEPTH_SIZE,      0,
       EGL_STENCIL_SIZE,    0,
       EGL_NONE,            // termination sentinel
@@ -573,7 +780,7 @@ bool WaylandDisplay::SetupEGL() {
 
     EGLint config_count = 0;
 
-    if (eglChooseConfig(egl_display_, attribs, &egl_config, 1, &config_count) !=
+    if (eglChooseConfig(egl_display_, attribs, nullptr, 0, &config_count) !=
         EGL_TRUE) {
       LogLastEGLError();
       FLWAY_ERROR << "Error when attempting to choose an EGL surface config."
@@ -581,11 +788,32 @@ bool WaylandDisplay::SetupEGL() {
       return false;
     }
 
-    if (config_count == 0 || egl_config == nullptr) {
+    std::vector<EGLConfig> configs(config_count);
+    if (config_count == 0 ||
+        eglChooseConfig(egl_display_, attribs, configs.data(), config_count,
+                        &config_count) != EGL_TRUE ||
+        config_count == 0) {
       LogLastEGLError();
       FLWAY_ERROR << "No matching configs." << std::endl;
       return false;
     }
+
+    // EGL sorts configs with more color bits first, so an opaque mode has to
+    // look past the ones with alpha.
+    egl_config = configs[0];
+    if (opaque_) {
+      for (EGLint i = 0; i < config_count; i++) {
+        EGLint alpha_size = 0;
+        eglGetConfigAttrib(egl_display_, configs[i], EGL_ALPHA_SIZE,
+                           &alpha_size);
+        if (alpha_size == 0) {
+          egl_config = configs[i];
+          break;
+        }
+      }
+    }
+
+    LogEGLConfig(egl_config);
   }
 
   // Create an EGL window surface with the matched config.
@@ -617,8 +845,151 @@ bool WaylandDisplay::SetupEGL() {
     }
   }
 
-  // Add For Drawing Cursor
-  cursor_surface_ = wl_compositor_create_surface(compositor_);
+  ResolveSwapBuffersWithDamage();
+
+  buffer_age_supported_ = HasEGLExtension(
+      eglQueryString(egl_display_, EGL_EXTENSIONS), "EGL_EXT_buffer_age");
+
+  if (!SetupResourceContext(egl_config)) {
+    // Not fatal. The engine uploads resources on the render thread instead.
+    FLWAY_ERROR << "Could not create a resource context." << std::endl;
+  }
+
+  if (subsurface_layers_) {
+    SetupLayerCompositor(egl_config);
+  }
+
+  return true;
+}
+
+// Enough for one buffer on screen, one queued in the compositor and one
+// being drawn into.
+static constexpr size_t kShmBufferCount = 3;
+
+uint32_t WaylandDisplay::GetShmFormat() const {
+  // Same memory layout. The compositor just ignores the alpha byte.
+  return opaque_ ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888;
+}
+
+bool WaylandDisplay::SetupSoftwareRendering() {
+  if (!shm_) {
+    FLWAY_ERROR << "Software rendering needs a missing shm connection."
+                << std::endl;
+    return false;
+  }
+
+  shm_pool_ = std::make_unique<ShmBufferPool>(
+      shm_, screen_width_, screen_height_, kShmBufferCount, GetShmFormat());
+  if (!shm_pool_->IsValid()) {
+    return false;
+  }
+
+  FLWAY_LOG << "Software rendering into "
+            << (opaque_ ? "XRGB8888" : "ARGB8888") << " buffers." << std::endl;
+  return true;
+}
+
+void WaylandDisplay::ResolveSwapBuffersWithDamage() {
+  const char* extensions = eglQueryString(egl_display_, EGL_EXTENSIONS);
+
+  const char* name = nullptr;
+  if (HasEGLExtension(extensions, "EGL_KHR_swap_buffers_with_damage")) {
+    name = "eglSwapBuffersWithDamageKHR";
+  } else if (HasEGLExtension(extensions, "EGL_EXT_swap_buffers_with_damage")) {
+    name = "eglSwapBuffersWithDamageEXT";
+  } else {
+    return;
+  }
+
+  swap_buffers_with_damage_ =
+      reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC>(
+          eglGetProcAddress(name));
+}
+
+void WaylandDisplay::SetupLayerCompositor(EGLConfig config) {
+  // Not fatal either. The engine then flattens the layers itself.
+  if (subcompositor_ == nullptr) {
+    FLWAY_ERROR << "Subsurface layers need a missing wl_subcompositor."
+                << std::endl;
+    return;
+  }
+
+  // The layers share the onscreen config, which has no alpha when opaque,
+  // and the viewport would only scale the bottom one.
+  if (opaque_ || viewport_) {
+    FLWAY_ERROR << "Subsurface layers are not supported with an opaque "
+                   "surface or adaptive resolution."
+                << std::endl;
+    return;
+  }
+
+  layer_compositor_ = std::make_unique<LayerCompositor>(
+      *this, compositor_, subcompositor_, surface_, egl_display_, config,
+      egl_context_);
+  if (!layer_compositor_->IsValid()) {
+    FLWAY_ERROR << "Could not create the layer compositor." << std::endl;
+    layer_compositor_.reset();
+    return;
+  }
+
+  FLWAY_LOG << "Presenting layers in subsurfaces." << std::endl;
+}
+
+bool WaylandDisplay::SetupResourceContext(EGLConfig onscreen_config) {
+  const char* extensions = eglQueryString(egl_display_, EGL_EXTENSIONS);
+  const bool surfaceless =
+      HasEGLExtension(extensions, "EGL_KHR_surfaceless_context");
+
+  EGLConfig egl_config = onscreen_config;
+
+  // Without surfaceless contexts, the resource context needs a surface to be
+  // made current with. A 1x1 pbuffer is the cheapest one.
+  if (!surfaceless) {
+    EGLint attribs[] = {
+        // clang-format off
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+      EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+      EGL_RED_SIZE,        8,
+      EGL_GREEN_SIZE,      8,
+      EGL_BLUE_SIZE,       8,
+      EGL_ALPHA_SIZE,      8,
+      EGL_DEPTH_SIZE,      0,
+      EGL_STENCIL_SIZE,    0,
+      EGL_NONE,            // termination sentinel
+        // clang-format on
+    };
+
+    EGLint config_count = 0;
+    if (eglChooseConfig(egl_display_, attribs, &egl_config, 1,
+                        &config_count) != EGL_TRUE ||
+        config_count == 0) {
+      LogLastEGLError();
+      FLWAY_ERROR << "No matching pbuffer configs." << std::endl;
+      return false;
+    }
+
+    const EGLint surface_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    egl_resource_surface_ =
+        eglCreatePbufferSurface(egl_display_, egl_config, surface_attribs);
+    if (egl_resource_surface_ == EGL_NO_SURFACE) {
+      LogLastEGLError();
+      FLWAY_ERROR << "Could not create the resource pbuffer." << std::endl;
+      return false;
+    }
+  }
+
+  const EGLint attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+
+  // Share with the onscreen context so textures uploaded here can be drawn
+  // there.
+  egl_resource_context_ =
+      eglCreateContext(egl_display_, egl_config, egl_context_, attribs);
+
+  if (egl_resource_context_ == EGL_NO_CONTEXT) {
+    LogLastEGLError();
+    FLWAY_ERROR << "Could not create a resource context." << std::endl;
+    return false;
+  }
 
   return true;
 }
@@ -629,7 +1000,9 @@ void WaylandDisplay::AnnounceRegistryInterface(struct wl_registry* wl_registry,
                                                uint32_t version) {
   if (strcmp(interface_name, "wl_compositor") == 0) {
     compositor_ = static_cast<decltype(compositor_)>(
-        wl_registry_bind(wl_registry, name, &wl_compositor_interface, 1));
+        wl_registry_bind(wl_registry, name, &wl_compositor_interface,
+                         std::min(version, 4u)));
+    compositor_version_ = std::min(version, 4u);
     return;
   }
 
@@ -647,6 +1020,36 @@ void WaylandDisplay::AnnounceRegistryInterface(struct wl_registry* wl_registry,
     return;
   }
 
+  if (strcmp(interface_name, "wl_output") == 0) {
+    auto output = std::make_unique<Output>();
+    output->display = this;
+    output->name = name;
+    output->output = static_cast<wl_output*>(wl_registry_bind(
+        wl_registry, name, &wl_output_interface, std::min(version, 2u)));
+    wl_output_add_listener(output->output, &kOutputListener, output.get());
+    outputs_.push_back(std::move(output));
+    return;
+  }
+
+  if (strcmp(interface_name, "wl_subcompositor") == 0) {
+    subcompositor_ = static_cast<decltype(subcompositor_)>(
+        wl_registry_bind(wl_registry, name, &wl_subcompositor_interface, 1));
+    return;
+  }
+
+  if (strcmp(interface_name, "wp_presentation") == 0) {
+    presentation_tracker_ = std::make_unique<PresentationTracker>(
+        static_cast<wp_presentation*>(wl_registry_bind(
+            wl_registry, name, &wp_presentation_interface, 1)));
+    return;
+  }
+
+  if (strcmp(interface_name, "wp_viewporter") == 0) {
+    viewporter_ = static_cast<decltype(viewporter_)>(
+        wl_registry_bind(wl_registry, name, &wp_viewporter_interface, 1));
+    return;
+  }
+
   // Add For Drawing Cursor
   if (strcmp(interface_name, "wl_shm") == 0) {
     shm_ = static_cast<decltype(shm_)>(
@@ -672,7 +1075,16 @@ void WaylandDisplay::AnnounceRegistryInterface(struct wl_registry* wl_registry,
 
 void WaylandDisplay::UnannounceRegistryInterface(
     struct wl_registry* wl_registry,
-    uint32_t name) {}
+    uint32_t name) {
+  for (auto it = outputs_.begin(); it != outputs_.end(); ++it) {
+    if ((*it)->name == name) {
+      wl_output_destroy((*it)->output);
+      outputs_.erase(it);
+      OnOutputsChanged();
+      return;
+    }
+  }
+}
 
 // |flutter::FlutterApplication::RenderDelegate|
 bool WaylandDisplay::OnApplicationContextMakeCurrent() {
@@ -688,6 +1100,16 @@ bool WaylandDisplay::OnApplicationContextMakeCurrent() {
     return false;
   }
 
+  // The swap interval belongs to the surface, but can only be set through a
+  // current context.
+  if (!swap_interval_applied_) {
+    swap_interval_applied_ = true;
+    if (eglSwapInterval(egl_display_, swap_interval_) != EGL_TRUE) {
+      LogLastEGLError();
+      FLWAY_ERROR << "Could not set the swap interval." << std::endl;
+    }
+  }
+
   return true;
 }
 
@@ -708,6 +1130,23 @@ bool WaylandDisplay::OnApplicationContextClearCurrent() {
   return true;
 }
 
+// |flutter::FlutterApplication::RenderDelegate|
+bool WaylandDisplay::OnApplicationMakeResourceCurrent() {
+  if (!valid_ || egl_resource_context_ == EGL_NO_CONTEXT) {
+    return false;
+  }
+
+  if (eglMakeCurrent(egl_display_, egl_resource_surface_,
+                     egl_resource_surface_,
+                     egl_resource_context_) != EGL_TRUE) {
+    LogLastEGLError();
+    FLWAY_ERROR << "Could not make the resource context current" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
 // |flutter::FlutterApplication::RenderDelegate|
 bool WaylandDisplay::OnApplicationPresent() {
   if (!valid_) {
@@ -715,12 +1154,589 @@ bool WaylandDisplay::OnApplicationPresent() {
     return false;
   }
 
-  if (eglSwapBuffers(egl_display_, egl_surface_) != EGL_TRUE) {
+  return SwapBuffers(nullptr, 0);
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool WaylandDisplay::OnApplicationPresentWithDamage(const FlutterRect* damage,
+                                                    size_t damage_count) {
+  if (!valid_) {
+    FLWAY_ERROR << "Invalid display." << std::endl;
+    return false;
+  }
+
+  return SwapBuffers(damage, damage_count);
+}
+
+void WaylandDisplay::OnConfigure(int32_t width, int32_t height) {
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+
+  RequestWindowSize(width, height);
+}
+
+void WaylandDisplay::RequestWindowSize(int width, int height) {
+  // An interactive resize sends configure events far faster than frames can
+  // be drawn. Only the latest size matters, and it is sent once the frame
+  // for the previous one is on screen.
+  pending_window_width_ = width;
+  pending_window_height_ = height;
+  if (!awaiting_resized_frame_) {
+    SendWindowSize(width, height);
+  }
+}
+
+void WaylandDisplay::OnSurfaceOutputChanged(wl_output* output, bool entered) {
+  for (const auto& candidate : outputs_) {
+    if (candidate->output == output) {
+      candidate->entered = entered;
+    }
+  }
+  OnOutputsChanged();
+}
+
+void WaylandDisplay::OnOutputsChanged() {
+  // Render for the densest output the surface is on, and keep vsync in step
+  // with the fastest one. Before the surface enters any output, go by all of
+  // them.
+  bool any_entered = false;
+  for (const auto& output : outputs_) {
+    any_entered |= output->entered;
+  }
+
+  int32_t scale = 0;
+  int32_t refresh = 0;
+  for (const auto& output : outputs_) {
+    if (output->entered || !any_entered) {
+      scale = std::max(scale, output->scale);
+      refresh = std::max(refresh, output->refresh);
+    }
+  }
+
+  if (refresh > 0) {
+    // |refresh| is in mHz.
+    vsync_waiter_->SetRefreshPeriod(
+        std::chrono::nanoseconds(1000000000000LL / refresh));
+  }
+
+  // Without wl_surface.set_buffer_scale, the compositor always upscales.
+  if (compositor_version_ < WL_SURFACE_SET_BUFFER_SCALE_SINCE_VERSION) {
+    scale = 1;
+  }
+
+  if (scale == 0 || scale == window_scale_) {
+    return;
+  }
+
+  window_scale_ = scale;
+  ResendWindowSize();
+}
+
+void WaylandDisplay::ResendWindowSize() {
+  if (pending_window_width_ != 0) {
+    RequestWindowSize(pending_window_width_, pending_window_height_);
+  } else {
+    RequestWindowSize(window_width_, window_height_);
+  }
+}
+
+void WaylandDisplay::OnFrameCallbackDone(uint32_t time_ms) {
+  {
+    std::lock_guard<std::mutex> lock(frames_in_flight_mutex_);
+    frames_in_flight_ = std::max(frames_in_flight_ - 1, 0);
+  }
+  frames_in_flight_cv_.notify_one();
+
+  vsync_waiter_->OnFrameCallbackDone(time_ms);
+
+  awaiting_resized_frame_ = false;
+  if (pending_window_width_ != 0) {
+    SendWindowSize(pending_window_width_, pending_window_height_);
+  }
+
+  const double render_scale =
+      requested_render_scale_.load(std::memory_order_relaxed);
+  if (render_scale != render_scale_) {
+    render_scale_ = render_scale;
+    ResendWindowSize();
+  }
+}
+
+void WaylandDisplay::OnVisibilityChanged(bool visible) {
+  {
+    std::lock_guard<std::mutex> lock(frames_in_flight_mutex_);
+    surface_visible_.store(visible, std::memory_order_relaxed);
+  }
+  frames_in_flight_cv_.notify_one();
+
+  if (application == nullptr) {
+    return;
+  }
+
+  // Paused stops the framework from scheduling frames at all. Resuming makes
+  // it draw a fresh one straight away.
+  application->SendLifecycleState(visible ? LifecycleState::resumed
+                                          : LifecycleState::paused);
+}
+
+bool WaylandDisplay::SendInitialWindowSize() {
+  sent_window_scale_ = 0;
+  return SendWindowSize(window_width_, window_height_);
+}
+
+bool WaylandDisplay::SendWindowSize(int width, int height) {
+  pending_window_width_ = 0;
+  pending_window_height_ = 0;
+
+  if (width == window_width_ && height == window_height_ &&
+      window_scale_ == sent_window_scale_ &&
+      render_scale_ == sent_render_scale_) {
+    return true;
+  }
+
+  if (application == nullptr) {
+    // Sent by SendInitialWindowSize once there is one.
+    window_width_ = width;
+    window_height_ = height;
+    return true;
+  }
+
+  // Below native resolution, the buffer is no longer a whole multiple of the
+  // surface size. The viewport scales it up instead of the buffer scale.
+  const double pixel_ratio = window_scale_ * render_scale_;
+  const int buffer_width = std::max(1, static_cast<int>(width * pixel_ratio));
+  const int buffer_height =
+      std::max(1, static_cast<int>(height * pixel_ratio));
+
+  {
+    std::lock_guard<std::mutex> lock(buffer_scale_mutex_);
+    sent_buffer_width_ = buffer_width;
+    sent_buffer_height_ = buffer_height;
+    sent_buffer_scale_ = window_scale_;
+    sent_buffer_render_scale_ = render_scale_;
+    sent_surface_width_ = width;
+    sent_surface_height_ = height;
+  }
+
+  if (!application->SetWindowSize(buffer_width, buffer_height, pixel_ratio)) {
+    FLWAY_ERROR << "Could not update Flutter application size." << std::endl;
+    return false;
+  }
+
+  window_width_ = width;
+  window_height_ = height;
+  sent_window_scale_ = window_scale_;
+  sent_render_scale_ = render_scale_;
+  pixel_ratio_ = pixel_ratio;
+  awaiting_resized_frame_ = true;
+  return true;
+}
+
+void WaylandDisplay::SetOpaqueRegion(int width, int height) {
+  // Lets the compositor skip blending the surface, and skip drawing whatever
+  // it covers. Applied with the next commit.
+  wl_region* region = wl_compositor_create_region(compositor_);
+  wl_region_add(region, 0, 0, width, height);
+  wl_surface_set_opaque_region(surface_, region);
+  wl_region_destroy(region);
+}
+
+void WaylandDisplay::ResizeSurface(int width, int height) {
+  screen_width_ = width;
+  screen_height_ = height;
+
+  // The buffer scale is latched with the commit of the first frame rendered
+  // for the metrics it was sent with.
+  int32_t scale = buffer_scale_;
+  int surface_width = 0;
+  int surface_height = 0;
+  {
+    std::lock_guard<std::mutex> lock(buffer_scale_mutex_);
+    if (width == sent_buffer_width_ && height == sent_buffer_height_) {
+      scale = sent_buffer_scale_;
+      surface_width = sent_surface_width_;
+      surface_height = sent_surface_height_;
+    }
+  }
+  if (opaque_ && surface_width != 0) {
+    SetOpaqueRegion(surface_width, surface_height);
+  }
+
+  if (viewport_) {
+    // The buffer scale stays at one. The viewport maps the whole buffer,
+    // whatever its size, onto the surface.
+    if (surface_width != 0) {
+      wp_viewport_set_destination(viewport_, surface_width, surface_height);
+    }
+  } else if (scale != buffer_scale_) {
+    buffer_scale_ = scale;
+    wl_surface_set_buffer_scale(surface_, scale);
+  }
+
+  // None of the buffers hold a frame of this size.
+  damage_history_.clear();
+
+  if (window_) {
+    wl_egl_window_resize(window_, width, height, 0, 0);
+  }
+
+  if (shm_pool_) {
+    front_buffer_ = nullptr;
+    shm_row_damage_.clear();
+    shm_pool_ = std::make_unique<ShmBufferPool>(
+        shm_, width, height, kShmBufferCount, GetShmFormat());
+    if (!shm_pool_->IsValid()) {
+      FLWAY_ERROR << "Could not resize the shared memory buffers."
+                  << std::endl;
+      shm_pool_.reset();
+    }
+  }
+}
+
+void WaylandDisplay::LatchFrameVsyncStart() {
+  // The engine starts rasterizing a frame as soon as it is built, before it
+  // asks for the next vsync. The latest one is the frame's own, unless the
+  // next one already fired in between.
+  frame_vsync_start_ = std::chrono::steady_clock::time_point(
+      std::chrono::steady_clock::duration(
+          vsync_start_.load(std::memory_order_relaxed)));
+}
+
+void WaylandDisplay::RequestFrameCallback() {
+  // Ask to be told when the compositor is ready for the frame after the one
+  // committed next.
+  wl_callback* frame_callback = wl_surface_frame(surface_);
+  wl_callback_add_listener(frame_callback, &kFrameListener, this);
+  vsync_waiter_->OnFrameCallbackRequested();
+
+  // Without the vsync the frame was started at, there is no latency to
+  // measure. That is the case until the engine first asked for one.
+  if (presentation_tracker_ &&
+      frame_vsync_start_ != std::chrono::steady_clock::time_point()) {
+    presentation_tracker_->OnCommit(surface_, frame_vsync_start_);
+  }
+
+  std::lock_guard<std::mutex> lock(frames_in_flight_mutex_);
+  frames_in_flight_++;
+}
+
+// One frame on screen and one queued behind it. Any more only adds latency.
+static constexpr int kMaxFramesInFlight = 2;
+
+void WaylandDisplay::WaitForFrameSlot() {
+  // Never wait longer than a frame. A compositor that is late with its frame
+  // callbacks should not hold up the render thread, and interval zero swaps
+  // do not block even then.
+  std::unique_lock<std::mutex> lock(frames_in_flight_mutex_);
+  frames_in_flight_cv_.wait_for(lock, vsync_waiter_->GetRefreshPeriod(), [&] {
+    return frames_in_flight_ < kMaxFramesInFlight ||
+           !surface_visible_.load(std::memory_order_relaxed);
+  });
+}
+
+bool WaylandDisplay::SwapBuffers(const FlutterRect* damage,
+                                 size_t damage_count) {
+  const auto wait_start = std::chrono::steady_clock::now();
+  if (swap_interval_ == 0) {
+    WaitForFrameSlot();
+  }
+  // Waiting on the compositor does not count towards the frame time.
+  frame_start_ += std::chrono::steady_clock::now() - wait_start;
+
+  // A frame already in flight when the surface got hidden. Nobody would see
+  // it, and with the compositor not sending frame callbacks, the swap could
+  // block the render thread until the surface is shown again.
+  if (!surface_visible_.load(std::memory_order_relaxed)) {
+    frame_dropped_ = true;
+    damage_history_.clear();
+    return true;
+  }
+
+  // The damage of a dropped frame never reached the compositor.
+  if (frame_dropped_) {
+    frame_dropped_ = false;
+    damage_count = 0;
+  }
+
+  RecordFrameDamage(damage, damage_count);
+
+  // The request is sent with the commit inside the swap.
+  RequestFrameCallback();
+
+  // The frame damage usually is a single rectangle. Frames with more than
+  // this are rare enough to just damage everything.
+  static constexpr size_t kMaxDamageRects = 16;
+
+  if (swap_buffers_with_damage_ == nullptr || damage_count == 0 ||
+      damage_count > kMaxDamageRects) {
+    if (eglSwapBuffers(egl_display_, egl_surface_) != EGL_TRUE) {
+      LogLastEGLError();
+      FLWAY_ERROR << "Could not swap the EGL buffer." << std::endl;
+      return false;
+    }
+    RecordFrameTime();
+    return true;
+  }
+
+  // EGL wants x, y, width, height with a bottom-left origin. Round outwards
+  // so partially covered pixels are still damaged.
+  EGLint rects[kMaxDamageRects * 4];
+  EGLint rect_count = 0;
+  for (size_t i = 0; i < damage_count; i++) {
+    const FlutterRect& rect = damage[i];
+    const int left = std::max(0, static_cast<int>(std::floor(rect.left)));
+    const int top = std::max(0, static_cast<int>(std::floor(rect.top)));
+    const int right =
+        std::min(screen_width_, static_cast<int>(std::ceil(rect.right)));
+    const int bottom =
+        std::min(screen_height_, static_cast<int>(std::ceil(rect.bottom)));
+    if (right <= left || bottom <= top) {
+      continue;
+    }
+    EGLint* out = &rects[rect_count++ * 4];
+    out[0] = left;
+    out[1] = screen_height_ - bottom;
+    out[2] = right - left;
+    out[3] = bottom - top;
+  }
+
+  // An empty list would mean the whole surface to EGL. Nothing visible
+  // changed, so a single pixel is the least that can be damaged.
+  if (rect_count == 0) {
+    rects[0] = 0;
+    rects[1] = 0;
+    rects[2] = 1;
+    rects[3] = 1;
+    rect_count = 1;
+  }
+
+  if (swap_buffers_with_damage_(egl_display_, egl_surface_, rects,
+                                rect_count) != EGL_TRUE) {
+    LogLastEGLError();
+    FLWAY_ERROR << "Could not swap the EGL buffer with damage." << std::endl;
+    return false;
+  }
+
+  RecordFrameTime();
+  return true;
+}
+
+void WaylandDisplay::RecordFrameTime() {
+  if (!adaptive_resolution_) {
+    return;
+  }
+
+  // The engine only draws at a new scale once the platform thread sent it,
+  // after the next frame callback. The window after a change starts with the
+  // first frame drawn at it.
+  if (pending_render_scale_ != 0.0) {
+    std::lock_guard<std::mutex> lock(buffer_scale_mutex_);
+    if (screen_width_ != sent_buffer_width_ ||
+        screen_height_ != sent_buffer_height_ ||
+        sent_buffer_render_scale_ != pending_render_scale_) {
+      return;
+    }
+    pending_render_scale_ = 0.0;
+  }
+
+  // From the engine asking for the framebuffer to the swap returning, which
+  // covers rasterization and submitting it to the GPU.
+  const auto frame_time = std::chrono::steady_clock::now() - frame_start_;
+  if (adaptive_resolution_->AddFrame(frame_time,
+                                     vsync_waiter_->GetRefreshPeriod())) {
+    pending_render_scale_ = adaptive_resolution_->GetScale();
+    requested_render_scale_.store(pending_render_scale_,
+                                  std::memory_order_relaxed);
+  }
+}
+
+// Covers more frames than any swap chain keeps buffers for.
+static constexpr size_t kDamageHistoryLength = 4;
+
+static void JoinRect(FlutterRect* bounds, const FlutterRect& rect) {
+  bounds->left = std::min(bounds->left, rect.left);
+  bounds->top = std::min(bounds->top, rect.top);
+  bounds->right = std::max(bounds->right, rect.right);
+  bounds->bottom = std::max(bounds->bottom, rect.bottom);
+}
+
+void WaylandDisplay::RecordFrameDamage(const FlutterRect* damage,
+                                       size_t damage_count) {
+  if (!buffer_age_supported_) {
+    return;
+  }
+
+  FlutterRect bounds = {0, 0, static_cast<double>(screen_width_),
+                        static_cast<double>(screen_height_)};
+  if (damage_count > 0) {
+    bounds = damage[0];
+    for (size_t i = 1; i < damage_count; i++) {
+      JoinRect(&bounds, damage[i]);
+    }
+  }
+
+  damage_history_.push_front(bounds);
+  if (damage_history_.size() > kDamageHistoryLength) {
+    damage_history_.pop_back();
+  }
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool WaylandDisplay::OnApplicationSupportsPartialRepaint() {
+  return buffer_age_supported_;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+void WaylandDisplay::OnApplicationPopulateExistingDamage(
+    FlutterDamage* existing_damage) {
+  existing_damage->num_rects = 1;
+  existing_damage->damage = &existing_damage_;
+  existing_damage_ = {0, 0, static_cast<double>(screen_width_),
+                      static_cast<double>(screen_height_)};
+
+  // An age of N means the back buffer holds the frame presented N swaps ago,
+  // so everything damaged by the N - 1 frames since is stale. Zero means the
+  // contents are undefined.
+  EGLint age = 0;
+  if (eglQuerySurface(egl_display_, egl_surface_, EGL_BUFFER_AGE_EXT, &age) !=
+      EGL_TRUE) {
     LogLastEGLError();
-    FLWAY_ERROR << "Could not swap the EGL buffer." << std::endl;
+    return;
+  }
+  if (age <= 0 || static_cast<size_t>(age - 1) > damage_history_.size()) {
+    return;
+  }
+
+  if (age == 1) {
+    existing_damage_ = {0, 0, 0, 0};
+    return;
+  }
+
+  existing_damage_ = damage_history_[0];
+  for (EGLint i = 1; i < age - 1; i++) {
+    JoinRect(&existing_damage_, damage_history_[i]);
+  }
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+FlutterRendererType WaylandDisplay::OnApplicationGetRendererType() {
+  return software_rendering_ ? kSoftware : kOpenGL;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool WaylandDisplay::OnApplicationPresentSoftware(const void* allocation,
+                                                  size_t row_bytes,
+                                                  size_t height) {
+  if (!valid_) {
+    FLWAY_ERROR << "Invalid display." << std::endl;
+    return false;
+  }
+
+  // Without a frame size callback, presenting is the first the display hears
+  // of the frame.
+  LatchFrameVsyncStart();
+
+  // The software renderer has no frame size callback. Its allocation always
+  // has the size of the latest metrics update.
+  const int width = row_bytes / 4;
+  if (width != screen_width_ || static_cast<int>(height) != screen_height_) {
+    ResizeSurface(width, height);
+  }
+
+  if (!shm_pool_) {
+    return false;
+  }
+
+  // Nobody would see the frame. The next one is compared against the buffer
+  // on screen anyway, so nothing needs to be remembered.
+  if (!surface_visible_.load(std::memory_order_relaxed)) {
+    return true;
+  }
+
+  const auto* source = static_cast<const uint8_t*>(allocation);
+  const int32_t stride = shm_pool_->GetStride();
+  const size_t row_size = std::min(row_bytes, static_cast<size_t>(stride));
+  const int32_t rows = std::min(static_cast<int32_t>(height),
+                                shm_pool_->GetHeight());
+
+  auto rows_match = [&](const uint8_t* pixels, int32_t row) {
+    return memcmp(source + row * row_bytes, pixels + row * stride, row_size) ==
+           0;
+  };
+
+  // The engine does not say what changed, but the buffer on screen holds the
+  // previous frame. Trim the rows that match it from the top and bottom.
+  int32_t first_row = 0;
+  int32_t last_row = rows;
+  if (front_buffer_ != nullptr) {
+    while (first_row < last_row &&
+           rows_match(front_buffer_->pixels, first_row)) {
+      first_row++;
+    }
+    while (last_row > first_row &&
+           rows_match(front_buffer_->pixels, last_row - 1)) {
+      last_row--;
+    }
+  }
+
+  RequestFrameCallback();
+
+  // Nothing changed. Commit anyway so the frame callback still fires.
+  if (first_row == last_row) {
+    wl_surface_commit(surface_);
+    return true;
+  }
+
+  ShmBufferPool::Buffer* back_buffer = shm_pool_->AcquireBuffer();
+  if (back_buffer == nullptr) {
+    FLWAY_ERROR << "All shared memory buffers are busy. Dropping a frame."
+                << std::endl;
+    wl_surface_commit(surface_);
     return false;
   }
 
+  const uint64_t frame = ++shm_frame_;
+  shm_row_damage_.push_front({first_row, last_row});
+  if (shm_row_damage_.size() > kShmBufferCount) {
+    shm_row_damage_.pop_back();
+  }
+
+  // Besides this frame's rows, the buffer misses those of every frame
+  // presented since it was last drawn into.
+  int32_t copy_first_row = 0;
+  int32_t copy_last_row = rows;
+  const uint64_t age = frame - back_buffer->frame;
+  if (back_buffer->frame != 0 && age <= shm_row_damage_.size()) {
+    copy_first_row = first_row;
+    copy_last_row = last_row;
+    for (uint64_t i = 1; i < age; i++) {
+      copy_first_row = std::min(copy_first_row, shm_row_damage_[i].first);
+      copy_last_row = std::max(copy_last_row, shm_row_damage_[i].second);
+    }
+  }
+
+  for (int32_t row = copy_first_row; row < copy_last_row; row++) {
+    memcpy(back_buffer->pixels + row * stride, source + row * row_bytes,
+           row_size);
+  }
+  back_buffer->frame = frame;
+  back_buffer->busy.store(true, std::memory_order_relaxed);
+
+  wl_surface_attach(surface_, back_buffer->buffer, 0, 0);
+  if (compositor_version_ >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION) {
+    wl_surface_damage_buffer(surface_, 0, first_row, shm_pool_->GetWidth(),
+                             last_row - first_row);
+  } else {
+    // Surface coordinates are in logical pixels.
+    const int32_t top = first_row / buffer_scale_;
+    const int32_t bottom = (last_row + buffer_scale_ - 1) / buffer_scale_;
+    wl_surface_damage(surface_, 0, top, shm_pool_->GetWidth() / buffer_scale_,
+                      bottom - top);
+  }
+  wl_surface_commit(surface_);
+
+  front_buffer_ = back_buffer;
   return true;
 }
 
@@ -734,4 +1750,92 @@ uint32_t WaylandDisplay::OnApplicationGetOnscreenFBO() {
   return 0;  // FBO0
 }
 
+// |flutter::FlutterApplication::RenderDelegate|
+uint32_t WaylandDisplay::OnApplicationGetOnscreenFBOWithSize(size_t width,
+                                                             size_t height) {
+  if (!valid_) {
+    FLWAY_ERROR << "Invalid display." << std::endl;
+    return 999;
+  }
+
+  frame_start_ = std::chrono::steady_clock::now();
+  LatchFrameVsyncStart();
+
+  // The engine draws each frame at the size of the latest metrics update.
+  // Resizing here, on the render thread, keeps the EGL window in step with it.
+  if (static_cast<int>(width) != screen_width_ ||
+      static_cast<int>(height) != screen_height_) {
+    ResizeSurface(width, height);
+  }
+
+  return 0;  // FBO0
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+bool WaylandDisplay::OnApplicationVsync(intptr_t baton) {
+  if (!valid_) {
+    return false;
+  }
+
+  vsync_waiter_->AwaitVsync(baton);
+  return true;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+const FlutterCompositor* WaylandDisplay::OnApplicationGetCompositor() {
+  if (!layer_compositor_) {
+    return nullptr;
+  }
+  return layer_compositor_->GetFlutterCompositor();
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+wl_display* WaylandDisplay::OnApplicationGetWaylandDisplay() {
+  return display_;
+}
+
+// |flutter::FlutterApplication::RenderDelegate|
+void WaylandDisplay::OnApplicationWaylandDisplayLost() {
+  // Ends the main loop. The render thread stops presenting as well.
+  valid_ = false;
+}
+
+// |flutter::LayerCompositor::Delegate|
+EGLSurface WaylandDisplay::OnCompositorGetBaseSurface(size_t width,
+                                                      size_t height) {
+  LatchFrameVsyncStart();
+
+  // The engine asks for no onscreen framebuffer when it presents layers, so
+  // the surface follows the metrics here instead.
+  if (static_cast<int>(width) != screen_width_ ||
+      static_cast<int>(height) != screen_height_) {
+    ResizeSurface(width, height);
+  }
+  return egl_surface_;
+}
+
+// |flutter::LayerCompositor::Delegate|
+int32_t WaylandDisplay::OnCompositorGetBufferScale() {
+  return buffer_scale_;
+}
+
+// |flutter::LayerCompositor::Delegate|
+bool WaylandDisplay::OnCompositorPresentBase(bool swap) {
+  if (swap) {
+    return SwapBuffers(nullptr, 0);
+  }
+
+  // Only layers above the bottom one changed. Their subsurfaces still need
+  // a commit of the onscreen surface to be applied, paced like a swap.
+  if (swap_interval_ == 0) {
+    WaitForFrameSlot();
+  }
+  if (!surface_visible_.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  RequestFrameCallback();
+  wl_surface_commit(surface_);
+  return true;
+}
+
 }  // namespace flutter
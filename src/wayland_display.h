@@ -5,21 +5,43 @@
 #pragma once
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <wayland-client.h>
 #include <wayland-egl.h>
 #include <wayland-cursor.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+#include <utility>
 
+#include "adaptive_resolution.h"
+#include "embedder_options.h"
+#include "epoll_reactor.h"
+#include "viewporter-client-protocol.h"
 #include "flutter_application.h"
+#include "layer_compositor.h"
 #include "macros.h"
+#include "presentation_tracker.h"
+#include "shm_buffer_pool.h"
+#include "vsync_waiter.h"
 
 namespace flutter {
 
-class WaylandDisplay : public FlutterApplication::RenderDelegate {
+class WaylandDisplay : public FlutterApplication::RenderDelegate,
+                       public LayerCompositor::Delegate {
  public:
-  WaylandDisplay(size_t width, size_t height);
+  // Vsync timers are scheduled on |reactor|, which must be waited on from the
+  // thread dispatching this display and outlive it.
+  WaylandDisplay(EpollReactor& reactor,
+                 size_t width,
+                 size_t height,
+                 const EmbedderOptions& options);
 
   ~WaylandDisplay();
 
@@ -29,22 +51,127 @@ class WaylandDisplay : public FlutterApplication::RenderDelegate {
   wl_display* getDisplay();
   FlutterApplication* application = nullptr;
 
+  // Sends the window size and output scale to |application|, which must have
+  // been set. Later changes are sent as they happen.
+  bool SendInitialWindowSize();
+
+  // Writes presentation statistics to |stream|, if the compositor supports
+  // wp_presentation. Must be called on the platform thread.
+  void DumpStats(std::ostream& stream) const;
+
  private:
+  // State of one wl_output, as of its last done event.
+  struct Output {
+    WaylandDisplay* display = nullptr;
+    wl_output* output = nullptr;
+    uint32_t name = 0;
+    int32_t x = 0;
+    int32_t y = 0;
+    // In millimeters.
+    int32_t physical_width = 0;
+    int32_t physical_height = 0;
+    int32_t transform = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+    // In mHz.
+    int32_t refresh = 0;
+    int32_t scale = 1;
+    // Whether the surface is at least partially shown on this output.
+    bool entered = false;
+  };
+
   static const wl_registry_listener kRegistryListener; 
   static const wl_shell_surface_listener kShellSurfaceListener;
   static const wl_pointer_listener kPointerListener; // Add For Poiter Event Handling
   static const wl_touch_listener kTouchListener; // Add For Touch Event Handling
   static const wl_keyboard_listener kKeyboardListener; // Add For Keyboard Event Handling
   static const wl_seat_listener kSeatListener; // Add For Seat Event Handling
-  bool valid_ = false;
-  const int screen_width_;
-  const int screen_height_;
+  static const wl_output_listener kOutputListener;
+  static const wl_surface_listener kSurfaceListener;
+  static const wl_callback_listener kFrameListener;
+  // Cleared on the platform thread if the connection breaks, while the render
+  // thread may be checking it.
+  std::atomic<bool> valid_{false};
+  // Size of the onscreen surface. Set on the render thread once the engine
+  // has started.
+  int screen_width_;
+  int screen_height_;
+  // Size last sent to the engine, and the one asked for by a configure event
+  // still waiting for a frame. Only touched on the platform thread.
+  int window_width_;
+  int window_height_;
+  int pending_window_width_ = 0;
+  int pending_window_height_ = 0;
+  // Set from a window metrics update until the next frame callback. Further
+  // configure events in between are coalesced into the pending size.
+  bool awaiting_resized_frame_ = false;
+  // Scale of the densest output the surface is on, and the one last sent to
+  // the engine along with the window size. Only touched on the platform
+  // thread.
+  int32_t window_scale_ = 1;
+  int32_t sent_window_scale_ = 1;
+  // Fraction of the native resolution rendered at, and the one last sent to
+  // the engine. Only touched on the platform thread.
+  double render_scale_ = 1.0;
+  double sent_render_scale_ = 1.0;
+  // Physical pixels per surface coordinate as last sent to the engine.
+  double pixel_ratio_ = 1.0;
+  // Buffer size and scale of the last metrics update, for the render thread
+  // to pick the scale up with the first frame drawn at that size.
+  std::mutex buffer_scale_mutex_;
+  int sent_buffer_width_;
+  int sent_buffer_height_;
+  int32_t sent_buffer_scale_ = 1;
+  double sent_buffer_render_scale_ = 1.0;
+  int sent_surface_width_;
+  int sent_surface_height_;
+  // Scale set on the surface. Only touched on the render thread.
+  int32_t buffer_scale_ = 1;
+  // Cleared while the compositor is not showing the surface. Frames are
+  // dropped rather than presented then.
+  std::atomic<bool> surface_visible_{true};
+  // Set on the render thread when a frame was dropped, so that the next one
+  // damages everything.
+  bool frame_dropped_ = false;
+  // Commits whose frame callback has not arrived yet. With a swap interval
+  // of zero, the render thread waits on this instead of inside EGL.
+  std::mutex frames_in_flight_mutex_;
+  std::condition_variable frames_in_flight_cv_;
+  int frames_in_flight_ = 0;
+  // Adaptive resolution mode only. Fed with frame times on the render thread,
+  // which hands the scale it picks to the platform thread.
+  std::unique_ptr<AdaptiveResolution> adaptive_resolution_;
+  std::chrono::steady_clock::time_point frame_start_;
+  std::atomic<double> requested_render_scale_{1.0};
+  // The scale last picked, until the first frame rendered at it. Frames are
+  // not timed in between, as they are still drawn at the previous scale.
+  // Zero when there is none. Only touched on the render thread.
+  double pending_render_scale_ = 0.0;
+  // Start of the vsync interval last handed to the engine, in nanoseconds of
+  // the steady clock, and the one the frame being drawn was started at.
+  std::atomic<int64_t> vsync_start_{0};
+  std::chrono::steady_clock::time_point frame_vsync_start_;
+  const bool software_rendering_;
+  const int swap_interval_;
+  // Whether the surface is declared opaque and rendered without alpha.
+  const bool opaque_;
+  const bool subsurface_layers_;
+  bool swap_interval_applied_ = false;
   wl_display* display_ = nullptr;
   wl_registry* registry_ = nullptr;
   wl_compositor* compositor_ = nullptr;
+  uint32_t compositor_version_ = 0;
   wl_shell* shell_ = nullptr;
   wl_shell_surface* shell_surface_ = nullptr;
   wl_surface* surface_ = nullptr;
+  wp_viewporter* viewporter_ = nullptr;
+  // Only created in adaptive resolution mode.
+  wp_viewport* viewport_ = nullptr;
+  wl_subcompositor* subcompositor_ = nullptr;
+  std::vector<std::unique_ptr<Output>> outputs_;
+  std::unique_ptr<VsyncWaiter> vsync_waiter_;
+  // Only with wp_presentation.
+  std::unique_ptr<PresentationTracker> presentation_tracker_;
 
   wl_seat* seat_ = nullptr; // Add For Poiter Event Handling
   wl_pointer* pointer_ = nullptr; // Add For Pointer Event Handling
@@ -56,10 +183,34 @@ class WaylandDisplay : public FlutterApplication::RenderDelegate {
   wl_cursor *default_cursor_ = nullptr; // Add For Drawing Cursor
   wl_surface *cursor_surface_ = nullptr; // Add For Drawing Cursor
 
+  // Software rendering only. Touched on the render thread, except for the
+  // buffers' busy flags.
+  std::unique_ptr<ShmBufferPool> shm_pool_;
+  ShmBufferPool::Buffer* front_buffer_ = nullptr;
+  uint64_t shm_frame_ = 0;
+  // Rows [first, second) changed by the most recent frames, newest first.
+  std::deque<std::pair<int32_t, int32_t>> shm_row_damage_;
+
   wl_egl_window* window_ = nullptr;
   EGLDisplay egl_display_ = EGL_NO_DISPLAY;
   EGLSurface egl_surface_ = nullptr;
   EGLContext egl_context_ = EGL_NO_CONTEXT;
+  // Shares the onscreen context's objects. The engine's IO thread uploads
+  // textures with it. Bound to no surface at all when the driver supports
+  // surfaceless contexts, and to a 1x1 pbuffer otherwise.
+  EGLContext egl_resource_context_ = EGL_NO_CONTEXT;
+  EGLSurface egl_resource_surface_ = EGL_NO_SURFACE;
+  // Subsurface layers mode only.
+  std::unique_ptr<LayerCompositor> layer_compositor_;
+  // eglSwapBuffersWithDamageKHR, or the identical EXT entry point. Null when
+  // the driver supports neither and every swap damages the whole surface.
+  PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_buffers_with_damage_ = nullptr;
+  // Set when EGL_EXT_buffer_age tells how many frames old a back buffer is.
+  bool buffer_age_supported_ = false;
+  // Bounds of the damage of the most recent frames, newest first. Only
+  // touched on the render thread.
+  std::deque<FlutterRect> damage_history_;
+  FlutterRect existing_damage_ = {};
   
   double mouse_x_ = 0.0; // Add For Poiter Event Handling
   double mouse_y_ = 0.0; // Add For Poiter Event Handling
@@ -67,8 +218,55 @@ class WaylandDisplay : public FlutterApplication::RenderDelegate {
   double touch_y_ = 0.0; // Add For Touch Event Handling
   int32_t touch_id_ = -1; // Add For Poiter Event Handling
 
+  bool SetupSurface();
+
   bool SetupEGL();
 
+  bool SetupSoftwareRendering();
+
+  void LogEGLConfig(EGLConfig config) const;
+
+  uint32_t GetShmFormat() const;
+
+  void SetOpaqueRegion(int width, int height);
+
+  bool SetupResourceContext(EGLConfig onscreen_config);
+
+  void SetupLayerCompositor(EGLConfig config);
+
+  void ResolveSwapBuffersWithDamage();
+
+  void OnConfigure(int32_t width, int32_t height);
+
+  void RequestWindowSize(int width, int height);
+
+  void OnSurfaceOutputChanged(wl_output* output, bool entered);
+
+  void OnOutputsChanged();
+
+  void ResendWindowSize();
+
+  // |time_ms| is the timestamp the compositor sent with the callback.
+  void OnFrameCallbackDone(uint32_t time_ms);
+
+  void OnVisibilityChanged(bool visible);
+
+  bool SendWindowSize(int width, int height);
+
+  void ResizeSurface(int width, int height);
+
+  void RequestFrameCallback();
+
+  void LatchFrameVsyncStart();
+
+  void WaitForFrameSlot();
+
+  void RecordFrameTime();
+
+  bool SwapBuffers(const FlutterRect* damage, size_t damage_count);
+
+  void RecordFrameDamage(const FlutterRect* damage, size_t damage_count);
+
   void AnnounceRegistryInterface(struct wl_registry* wl_registry,
                                  uint32_t name,
                                  const char* interface,
@@ -85,12 +283,59 @@ class WaylandDisplay : public FlutterApplication::RenderDelegate {
   // |flutter::FlutterApplication::RenderDelegate|
   bool OnApplicationContextClearCurrent() override;
 
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationMakeResourceCurrent() override;
+
   // |flutter::FlutterApplication::RenderDelegate|
   bool OnApplicationPresent() override;
 
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationPresentWithDamage(const FlutterRect* damage,
+                                      size_t damage_count) override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  FlutterRendererType OnApplicationGetRendererType() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationPresentSoftware(const void* allocation,
+                                    size_t row_bytes,
+                                    size_t height) override;
+
   // |flutter::FlutterApplication::RenderDelegate|
   uint32_t OnApplicationGetOnscreenFBO() override;
 
+  // |flutter::FlutterApplication::RenderDelegate|
+  uint32_t OnApplicationGetOnscreenFBOWithSize(size_t width,
+                                               size_t height) override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationSupportsPartialRepaint() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  void OnApplicationPopulateExistingDamage(
+      FlutterDamage* existing_damage) override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  bool OnApplicationVsync(intptr_t baton) override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  const FlutterCompositor* OnApplicationGetCompositor() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  wl_display* OnApplicationGetWaylandDisplay() override;
+
+  // |flutter::FlutterApplication::RenderDelegate|
+  void OnApplicationWaylandDisplayLost() override;
+
+  // |flutter::LayerCompositor::Delegate|
+  EGLSurface OnCompositorGetBaseSurface(size_t width, size_t height) override;
+
+  // |flutter::LayerCompositor::Delegate|
+  int32_t OnCompositorGetBufferScale() override;
+
+  // |flutter::LayerCompositor::Delegate|
+  bool OnCompositorPresentBase(bool swap) override;
+
   FLWAY_DISALLOW_COPY_AND_ASSIGN(WaylandDisplay);
 };
 
@@ -7,9 +7,11 @@
 #include "macros.h"
 #include <atomic>
 #include <utility>
-#include <poll.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 namespace flutter {
@@ -19,106 +21,191 @@ namespace flutter {
 #define WAYLAND_WAKEUP "wayland_wakeup"
 
 WayLandEventLoop::WayLandEventLoop(std::thread::id main_thread_id,
-                             const TaskExpiredCallback& on_task_expired)
-  : EventLoop(main_thread_id, std::move(on_task_expired)) {}
+                             const TaskExpiredCallback& on_task_expired,
+                             ClockDomain& clock_domain,
+                             EpollReactor& reactor)
+  : WayLandEventLoop(main_thread_id, std::move(on_task_expired), clock_domain,
+                     reactor, nullptr, nullptr) {}
 
 WayLandEventLoop::WayLandEventLoop(std::thread::id main_thread_id,
                              const TaskExpiredCallback& on_task_expired,
-                             WaylandDisplay* display)
-  : EventLoop(main_thread_id, std::move(on_task_expired)) {
+                             ClockDomain& clock_domain,
+                             EpollReactor& reactor,
+                             wl_display* display,
+                             const DisplayLostCallback& on_display_lost)
+  : EventLoop(main_thread_id, std::move(on_task_expired), clock_domain),
+    reactor_(reactor),
+    on_display_lost_(on_display_lost) {
     display_ = display;
-    if (pipe(wakeup_fd) == -1) {
-      FLWAY_ERROR << "pipe create failed" << std::endl; 
+    wakeup_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_fd_ == -1) {
+      FLWAY_ERROR << "eventfd create failed" << std::endl;
+      return;
+    }
+
+    // Unpolled, wakes and Wayland events would go unnoticed while the loop
+    // waits without a timeout.
+    if (!reactor_.AddFd(wakeup_fd_, EPOLLIN,
+                        [this](uint32_t events) { WayLandDrainWakeUp(); })) {
+      FLWAY_ERROR << "Could not poll the wakeup eventfd." << std::endl;
+      close(wakeup_fd_);
+      wakeup_fd_ = -1;
+      return;
+    }
+
+    if (display_ != nullptr &&
+        !reactor_.AddFd(wl_display_get_fd(display_), EPOLLIN,
+                        [this](uint32_t events) {
+                          if (events & EPOLLIN) {
+                            display_readable_ = true;
+                          }
+                          if (events & (EPOLLHUP | EPOLLERR)) {
+                            display_hung_up_ = true;
+                          }
+                        })) {
+      FLWAY_ERROR << "Could not poll the Wayland display." << std::endl;
+      display_ = nullptr;
+      reactor_.RemoveFd(wakeup_fd_);
+      close(wakeup_fd_);
+      wakeup_fd_ = -1;
     }
 }
 
 WayLandEventLoop::~WayLandEventLoop() {
-    close(wakeup_fd[0]);
-    close(wakeup_fd[1]);
-}
+    if (display_ != nullptr) {
+      reactor_.RemoveFd(wl_display_get_fd(display_));
+    }
 
-void WayLandEventLoop::WaitUntil(const TaskTimePoint& time) {
-  const auto now = TaskTimePoint::clock::now();
+    if (wakeup_fd_ != -1) {
+      reactor_.RemoveFd(wakeup_fd_);
+      close(wakeup_fd_);
+    }
+}
 
-  // Make sure the seconds are not integral.
-  using Seconds = std::chrono::duration<double, std::ratio<1>>;
-  const auto duration_to_wait = std::chrono::duration_cast<Seconds>(time - now);
+bool WayLandEventLoop::IsValid() const {
+  return wakeup_fd_ != -1;
+}
 
-  // Avoid engine task priority inversion by making sure WayLand events are
-  // always processed even when there is no need to wait for pending engine
-  // tasks.
-  WayLandWaitEventsTimeout(duration_to_wait.count());
+uint64_t WayLandEventLoop::GetCoalescedWakeCount() const {
+  return wakes_coalesced_.load(std::memory_order_relaxed);
 }
 
-void WayLandEventLoop::Wake() {
-  WayLandWakeUp();
+uint64_t WayLandEventLoop::GetDeliveredWakeCount() const {
+  return wakes_delivered_.load(std::memory_order_relaxed);
 }
 
-void WayLandEventLoop::WayLandWaitEventsTimeout(double timeout) {
-  struct pollfd pollfd[2] = {0};
-  int i, ret, count = 0;
-  uint32_t event = 0;
-  uint32_t wake_event = 0;
-  unsigned display_fd = wl_display_get_fd(display_->getDisplay());
-  pollfd[0].fd = display_fd;
-  pollfd[0].events = POLLIN | POLLERR | POLLHUP;
-  pollfd[1].fd = wakeup_fd[0];
-  pollfd[1].events = POLLIN ;
-  char r_buf[12] = {0};
-
-  std::chrono::duration<double> fs(std::abs(timeout)*1000);
-  std::chrono::milliseconds mTimeout = std::chrono::duration_cast<std::chrono::milliseconds>(fs);
-
-  while (display_->IsValid()) {
-    wl_display_dispatch_pending(display_->getDisplay());
-    ret = wl_display_flush(display_->getDisplay());
-    if (ret < 0 && errno != EAGAIN) {
-      break;
+EventLoop::WakeReason WayLandEventLoop::WaitUntil(const TaskTimePoint& time) {
+  wl_display* display = display_;
+
+  // Announce the intent to read before blocking so that EGL, which may read
+  // the same connection from the raster thread, cannot steal our events.
+  // Anything already queued has to be dispatched first.
+  if (display != nullptr) {
+    while (wl_display_prepare_read(display) != 0) {
+      if (wl_display_dispatch_pending(display) == -1) {
+        FLWAY_ERROR << "wl_display_dispatch failed with an error." << errno
+                    << std::endl;
+        WayLandDisplayLost();
+        return WakeReason::kEvent;
+      }
     }
-
-	count = poll(pollfd, 2, timeout <= 0 ? 0 : mTimeout.count());
-    if (count < 0 && errno != EINTR) {
-      FLWAY_ERROR << "poll returned an error." << errno;
-      break;
+    if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+      FLWAY_ERROR << "wl_display_flush failed with an error." << errno
+                  << std::endl;
+      wl_display_cancel_read(display);
+      WayLandDisplayLost();
+      return WakeReason::kEvent;
     }
+  }
 
-    if (count >= 1) {
-      wake_event = pollfd[1].revents;
-      if (wake_event & POLLIN) {
-        ret = read(wakeup_fd[0], r_buf, sizeof(r_buf));
-        if (-1 == ret) {
-          FLWAY_ERROR << "poll read failed: " << std::endl;
-          return;
-        }
-        // break;
-      }
-      event = pollfd[0].revents;
+  display_readable_ = false;
+  display_hung_up_ = false;
+  woken_ = false;
 
-      // We can have cases where POLLIN and POLLHUP are both set for
-      // example. Don't break if both flags are set.
-      if ((event & POLLERR || event & POLLHUP) && !(event & POLLIN)) {
-        break;
+  // Avoid engine task priority inversion by making sure WayLand events are
+  // always processed even when there is no need to wait for pending engine
+  // tasks: a deadline in the past still polls every descriptor once.
+  const auto result = reactor_.WaitUntil(time);
+
+  if (display != nullptr) {
+    bool lost = display_hung_up_;
+    if (display_readable_) {
+      if (wl_display_read_events(display) == -1) {
+        FLWAY_ERROR << "wl_display_read_events failed with an error." << errno
+                    << std::endl;
+        lost = true;
       }
+    } else {
+      wl_display_cancel_read(display);
+    }
 
-      if (event & POLLIN) {
-        ret = wl_display_dispatch(display_->getDisplay());
-        if (ret == -1) {
-          FLWAY_ERROR << "wl_display_dispatch failed with an error." << errno;
-        }
-      }
-      break;
+    // Whatever was read before the connection broke is still delivered.
+    if (wl_display_dispatch_pending(display) == -1) {
+      FLWAY_ERROR << "wl_display_dispatch failed with an error." << errno
+                  << std::endl;
+      lost = true;
     }
+
+    if (lost) {
+      WayLandDisplayLost();
+    }
+  }
+
+  const bool display_event = display_readable_ || display_hung_up_;
+  const size_t own_events = (display_event ? 1 : 0) + (woken_ ? 1 : 0);
+  if (display_event || result.dispatched > own_events) {
+    return WakeReason::kEvent;
+  }
+  if (woken_) {
+    return WakeReason::kWake;
+  }
+  if (result.deadline_reached) {
+    return WakeReason::kDeadline;
   }
-  return ;
+  return WakeReason::kNone;
 }
 
+void WayLandEventLoop::WayLandDisplayLost() {
+  FLWAY_ERROR << "Lost the connection to the Wayland compositor." << std::endl;
+  reactor_.RemoveFd(wl_display_get_fd(display_));
+  display_ = nullptr;
+  if (on_display_lost_) {
+    on_display_lost_();
+  }
+}
+
+void WayLandEventLoop::Wake() {
+  WayLandWakeUp();
+}
 
 void WayLandEventLoop::WayLandWakeUp() {
-  int ret = write(wakeup_fd[1], "wakeup", sizeof("wakeup"));
-  // FLWAY_LOG << "Post an Wakeup Event"<< std::endl;
-  if (-1 == ret) {
-    FLWAY_ERROR << "write wakeup fd failed: " << std::endl;
+  // Only the first wake after a drain needs to touch the eventfd. Everyone
+  // else piggybacks on it: the loop re-reads the task queue after draining.
+  if (wake_pending_.exchange(true, std::memory_order_acq_rel)) {
+    wakes_coalesced_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  const uint64_t value = 1;
+  int ret = write(wakeup_fd_, &value, sizeof(value));
+  if (-1 == ret && errno != EAGAIN) {
+    FLWAY_ERROR << "write wakeup fd failed: " << errno << std::endl;
+    wake_pending_.store(false, std::memory_order_release);
+    return;
+  }
+  wakes_delivered_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WayLandEventLoop::WayLandDrainWakeUp() {
+  uint64_t value = 0;
+  if (read(wakeup_fd_, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+    FLWAY_ERROR << "read wakeup fd failed: " << errno << std::endl;
   }
+  // Clear the flag only after the eventfd is drained. Clearing it first would
+  // let a concurrent Wake() signal the eventfd, have that signal swallowed by
+  // the read above, and leave the flag set with nothing to wake the loop.
+  wake_pending_.store(false, std::memory_order_release);
+  woken_ = true;
 }
 
 }  // namespace flutter
@@ -5,21 +5,38 @@
 #ifndef FLUTTER_SHELL_PLATFORM_WAYLAND_EVENT_LOOP_H_
 #define FLUTTER_SHELL_PLATFORM_WAYLAND_EVENT_LOOP_H_
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#include "epoll_reactor.h"
+#include <wayland-client.h>
+
 #include "event_loop.h"
-#include "wayland_display.h"
 
 namespace flutter {
 
 // An event loop implementation that supports Flutter Engine tasks scheduling in
-// the GLFW event loop.
+// the Wayland event loop.
+//
+// Waiting is delegated to |reactor|, which wakes up exactly at the next task
+// deadline, on a Wake() call, on Wayland traffic, or on any other descriptor
+// registered with it.
 class WayLandEventLoop : public EventLoop {
  public:
+  using DisplayLostCallback = std::function<void()>;
+
   WayLandEventLoop(std::thread::id main_thread_id,
-                  const TaskExpiredCallback& on_task_expired);
+                  const TaskExpiredCallback& on_task_expired,
+                  ClockDomain& clock_domain,
+                  EpollReactor& reactor);
 
   WayLandEventLoop(std::thread::id main_thread_id,
                   const TaskExpiredCallback& on_task_expired,
-                  WaylandDisplay* display);
+                  ClockDomain& clock_domain,
+                  EpollReactor& reactor,
+                  wl_display* display,
+                  const DisplayLostCallback& on_display_lost);
 
   virtual ~WayLandEventLoop();
 
@@ -27,15 +44,41 @@ class WayLandEventLoop : public EventLoop {
   WayLandEventLoop(const WayLandEventLoop&) = delete;
   WayLandEventLoop& operator=(const WayLandEventLoop&) = delete;
 
+  // False if the loop could not register its descriptors with the reactor.
+  bool IsValid() const;
+
+  // Returns the number of Wake() calls that were folded into a wakeup that was
+  // already pending on the eventfd.
+  uint64_t GetCoalescedWakeCount() const;
+
+  // Returns the number of Wake() calls that actually signalled the eventfd.
+  uint64_t GetDeliveredWakeCount() const;
+
  private:
   // EventLoop
-  void WaitUntil(const TaskTimePoint& time) override;
+  WakeReason WaitUntil(const TaskTimePoint& time) override;
   void Wake() override;
   void WayLandWakeUp();
-  void WayLandPollEvents();
-  void WayLandWaitEventsTimeout(double timeout);
-  int wakeup_fd[2] ;
-  WaylandDisplay* display_;
+  void WayLandDrainWakeUp();
+  // Stops polling |display_| after its connection broke and reports it.
+  void WayLandDisplayLost();
+  EpollReactor& reactor_;
+  int wakeup_fd_ = -1;
+  // Set by the reactor callback when the display fd became readable during the
+  // current wait.
+  bool display_readable_ = false;
+  // Set by the reactor callback on a hangup or error on the display fd.
+  // Epoll reports both whether asked to or not, for as long as they last.
+  bool display_hung_up_ = false;
+  // Set when the wakeup eventfd was drained during the current wait.
+  bool woken_ = false;
+  // Set by the first Wake() after the loop last drained the eventfd. Further
+  // wakes only bump |wakes_coalesced_| until the loop clears it again.
+  std::atomic<bool> wake_pending_{false};
+  std::atomic<uint64_t> wakes_coalesced_{0};
+  std::atomic<uint64_t> wakes_delivered_{0};
+  wl_display* display_ = nullptr;
+  DisplayLostCallback on_display_lost_;
 };
 
 }  // namespace flutter